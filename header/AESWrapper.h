@@ -6,13 +6,39 @@
  */
 
 #pragma once
+#include <memory>
+#include <span>
 #include <string>
 #include "protocol.h"
+#include "BufferPool.h"
 
 class AESWrapper
 {
 public:
+	static constexpr size_t BLOCK_SIZE = 16;  // CryptoPP::AES::BLOCKSIZE
+
 	static void GenerateKey(uint8_t* const buffer, const size_t length);
+	// CBC with PKCS #7 padding always adds 1 to BLOCK_SIZE bytes.
+	static constexpr size_t cipherSize(const size_t length) { return (length / BLOCK_SIZE + 1) * BLOCK_SIZE; }
+
+	// CBC encryption of a message given in consecutive parts. The chaining state is kept between parts.
+	class Encryptor
+	{
+	public:
+		explicit Encryptor(const AESKey& key);
+		virtual ~Encryptor();
+		Encryptor(const Encryptor& other) = delete;
+		Encryptor(Encryptor&& other) noexcept = delete;
+		Encryptor& operator=(const Encryptor& other) = delete;
+		Encryptor& operator=(Encryptor&& other) noexcept = delete;
+
+		size_t update(std::span<const uint8_t> plain, std::span<uint8_t> cipher);
+		size_t finish(std::span<const uint8_t> plain, std::span<uint8_t> cipher);
+
+	private:
+		struct Impl;
+		std::unique_ptr<Impl> _impl;
+	};
 
 	AESWrapper();
 	AESWrapper(const AESKey& symKey);
@@ -26,6 +52,8 @@ public:
 	AESKey getKey() const { return _key; }
 
 	std::string encrypt(const uint8_t* plain, size_t length) const;
+	void encrypt(const uint8_t* plain, size_t length, BufferPool::Buffer& cipher) const;
+	size_t encrypt(std::span<const uint8_t> plain, std::span<uint8_t> cipher) const;
 
 private:
 	AESKey _key;
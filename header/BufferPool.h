@@ -0,0 +1,103 @@
+/**
+ * Encrypted File Transfer Client
+ * @file BufferPool.h
+ * @brief Size-classed pool of reusable byte buffers for message construction & crypto output.
+ * Size classes are powers of two. Released buffers are cached per class up to a total of maxCachedBytes.
+ * Large buffers may optionally be backed by huge (large) pages.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class BufferPool
+{
+public:
+	static constexpr size_t MIN_CLASS_BITS = 12;   // 4 KB
+	static constexpr size_t MAX_CLASS_BITS = 30;   // 1 GB. Larger buffers are allocated exactly and never cached.
+	static constexpr size_t CLASSES = MAX_CLASS_BITS - MIN_CLASS_BITS + 1;
+	static constexpr size_t HUGE_PAGE_SIZE = static_cast<size_t>(2) << 20;
+	static constexpr size_t DEFAULT_MAX_CACHED_BYTES = static_cast<size_t>(64) << 20;
+	static constexpr size_t ALIGNMENT = 4096;   // page aligned, so buffers suit direct (O_DIRECT) I/O.
+
+	struct Block
+	{
+		uint8_t* data = nullptr;
+		size_t   capacity = 0;
+		bool     mapped = false;   // allocated by the OS page allocator rather than new[].
+	};
+
+	// Movable handle of a pooled buffer. Returns the buffer to the pool on destruction.
+	class Buffer
+	{
+	public:
+		Buffer() : _size(0) {}
+		Buffer(const Block& block, const size_t size) : _block(block), _size(size) {}
+		virtual ~Buffer() { release(); }
+		Buffer(const Buffer& other) = delete;
+		Buffer& operator=(const Buffer& other) = delete;
+		Buffer(Buffer&& other) noexcept;
+		Buffer& operator=(Buffer&& other) noexcept;
+
+		uint8_t* data() const { return _block.data; }
+		size_t size() const { return _size; }
+		size_t capacity() const { return _block.capacity; }
+		bool resize(const size_t size);
+		void release();
+		explicit operator bool() const { return _block.data != nullptr; }
+
+	private:
+		Block  _block;
+		size_t _size;
+	};
+
+	struct Stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t releases = 0;
+		uint64_t discards = 0;      // released buffers freed because the cache was full.
+		uint64_t cachedBytes = 0;
+	};
+
+	static BufferPool& instance();
+
+	virtual ~BufferPool();
+	BufferPool(const BufferPool& other) = delete;
+	BufferPool(BufferPool&& other) noexcept = delete;
+	BufferPool& operator=(const BufferPool& other) = delete;
+	BufferPool& operator=(BufferPool&& other) noexcept = delete;
+
+	Buffer acquire(const size_t size);
+	void trim();
+	Stats stats() const;
+
+	void setHugePages(const bool hugePages) { _hugePages.store(hugePages, std::memory_order_relaxed); }
+	void setMaxCachedBytes(const size_t bytes) { _maxCachedBytes.store(bytes, std::memory_order_relaxed); }
+
+private:
+	struct SizeClass
+	{
+		std::mutex         mutex;
+		std::vector<Block> free;
+	};
+
+	BufferPool();
+	void release(const Block& block);
+	Block allocate(const size_t capacity) const;
+	static void deallocate(const Block& block);
+	static size_t classIndex(const size_t size);
+
+	std::array<SizeClass, CLASSES> _classes;
+	std::atomic<bool>              _hugePages;
+	std::atomic<size_t>            _maxCachedBytes;
+	std::atomic<size_t>            _cachedBytes;
+	std::atomic<uint64_t>          _hits;
+	std::atomic<uint64_t>          _misses;
+	std::atomic<uint64_t>          _releases;
+	std::atomic<uint64_t>          _discards;
+};
@@ -0,0 +1,57 @@
+/**
+ * Encrypted File Transfer Client
+ * @file CancellationToken.h
+ * @brief Cancellation & overall deadline shared by the socket operations of a transfer.
+ * cancel() may be called from any thread. Subscribers (e.g. a socket blocked on I/O) are notified at once, so a
+ * blocking operation is aborted rather than waited out. Expiry of the deadline is detected by the socket operations,
+ * which then cancel the token, so the transfer's other connections are aborted too.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+
+class CancellationToken
+{
+public:
+	using Callback = std::function<void()>;
+
+	// Sets the token's deadline for its lifetime and clears an earlier cancellation. A zero timeout sets no deadline.
+	class DeadlineScope
+	{
+	public:
+		DeadlineScope(CancellationToken& token, const std::chrono::milliseconds timeout);
+		virtual ~DeadlineScope();
+		DeadlineScope(const DeadlineScope& other) = delete;
+		DeadlineScope& operator=(const DeadlineScope& other) = delete;
+
+	private:
+		CancellationToken& _token;
+	};
+
+	CancellationToken();
+	virtual ~CancellationToken() = default;
+	CancellationToken(const CancellationToken& other) = delete;
+	CancellationToken(CancellationToken&& other) noexcept = delete;
+	CancellationToken& operator=(const CancellationToken& other) = delete;
+	CancellationToken& operator=(CancellationToken&& other) noexcept = delete;
+
+	void cancel();
+	bool isCancelled() const { return _cancelled.load(std::memory_order_acquire); }
+	void reset(const std::chrono::steady_clock::time_point& deadline);
+	std::chrono::steady_clock::time_point deadline() const;
+
+	size_t subscribe(Callback callback);
+	void unsubscribe(const size_t id);
+
+private:
+	mutable std::mutex                    _mutex;
+	std::atomic<bool>                     _cancelled;
+	std::chrono::steady_clock::time_point _deadline;     // time_point::max() if none.
+	std::map<size_t, Callback>            _callbacks;
+	size_t                                _nextId;
+};
@@ -8,17 +8,43 @@
 
 #pragma once
 #include "protocol.h"
+#include "Options.h"
+#include "BufferPool.h"
+#include "ConcurrencyController.h"
+#include "ServerPool.h"
+#include "DirectoryScanner.h"
 #include <boost/crc.hpp>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
 
 constexpr auto CLIENT_INFO = "me.info";   // Should be located near exe file.
 constexpr auto SERVER_INFO = "transfer.info";  // Should be located near exe file.
+constexpr auto OPTIONS_INFO = "options.info";  // Optional. Should be located near exe file.
+constexpr auto SYNC_INFO = "sync.info";        // Files uploaded by directory sync. Located near exe file.
+constexpr auto SESSION_INFO = "session.info";  // Server holding the client's registration, of several, and replica IDs. Located near exe file.
+constexpr size_t MIN_STRIPE_SIZE = static_cast<size_t>(4) << 20;   // smaller content is not worth another connection.
+constexpr size_t MAX_STRIPES = 16;
+constexpr size_t MAX_FAILOVER_ATTEMPTS = 8;   // connect attempts over all servers per request.
+constexpr size_t REPLICA_CHUNK_SIZE = static_cast<size_t>(256) << 10;  // plain bytes encrypted & sent at once per replica.
+constexpr size_t DEFAULT_PACK_MAX_FILE_SIZE = static_cast<size_t>(64) << 10;  // larger files are sent on their own.
+constexpr size_t DEFAULT_PACK_MAX_BYTES = static_cast<size_t>(1) << 20;       // plain bytes of a packed container.
+constexpr size_t MAX_PACK_BYTES = static_cast<size_t>(256) << 20;
+constexpr size_t SYNC_BATCH_FILES = 256;   // files uploaded by directory sync between saves of SYNC_INFO.
+constexpr size_t MAX_WATCH_RETRIES = 3;    // failed uploads of a watched file before it is given up.
 
 class FileHandler;
 class SocketHandler;
 class RSAPrivateWrapper;
+class MultiplexedSession;
+class CancellationToken;
+class FolderWatcher;
+class UploadPipeline;
 
 class ClientLogic
 {
@@ -35,6 +61,14 @@ public:
 		bool			validCRC = false;
 	};
 
+	// Client ID & session key are kept per server. Registration & key exchange on a server yield its session.
+	struct Session
+	{
+		ClientID		id;
+		AESKey			key;
+		bool			keySet = false;
+	};
+
 
 public:
 	ClientLogic();
@@ -50,7 +84,9 @@ public:
 
 	// client logic to be invoked by client menu.
 	bool parseServeInfo();
+	bool parseOptionsInfo();
 	bool parseFileName(std::string& fileName);
+	bool parseFileNames(std::vector<std::string>& fileNames);
 	bool parseRegisteredClientInfo();
 	bool parseUnregisteredClientInfo(std::string& username);
 	bool registerClient(const std::string& username);
@@ -58,8 +94,16 @@ public:
 	bool changeRSAPair();
 	bool sendPublicKey();
 	bool sendFile(bool& sent);
+	bool sendFiles();
+	bool syncDirectory();
+	bool watchDirectory();
+	bool isPipelined() const { return _pipelineDepth > 1; }
+	bool isMultiplexed() const { return _multiplexStreams > 0; }
+	bool isPacked() const { return _packSmallFiles; }
+	void cancel();
 
 	uint32_t getCRC(const std::string& str);
+	uint32_t getCRC(const uint8_t* buffer, const size_t size);
 
 	bool isRSAGenerated();
 	bool isSymmetricKeySet();
@@ -69,12 +113,96 @@ public:
 
 private:
 	void clearLastError();
+	void setCommunicationError();
+	void applyOptions();
+	bool selectServer();
+	bool connectServer();
+	void releaseServer();
+	bool serverReachable();
+	void loadSession();
+	void bindSession();
+	void storeSession();
+	bool moveSession();
+	bool openSession(SocketHandler& socket, Session& session, const bool exchangeKey, std::string& error);
+	bool sessionMoved(const size_t moves);
 	bool storeClientInfo();
 	bool storeClientRSA();
-	bool validateHeader(const ResponseHeader& header, const ResponseCode expectedCode);
+	bool prepareFile(const std::string& filePath, BufferPool::Buffer& message, uint32_t& crc);
+	bool sendStaged(const std::string& filePath, ResponseFileAcception& response, uint32_t& crc);
+	bool uploadFile(const std::string& filePath, bool& sent);
+	bool uploadOnce(const std::string& filePath, bool& sent);
+	bool sendBatch(const std::vector<std::string>& filePaths, std::vector<bool>& validated);
+	bool sendSeparately(const std::vector<std::string>& filePaths, std::vector<bool>& validated);
+	bool sendPacked(const std::vector<std::string>& filePaths, const std::vector<std::pair<size_t, size_t>>& files, std::vector<bool>& validated);
+	bool packFiles(const std::vector<std::string>& filePaths, const std::vector<std::pair<size_t, size_t>>& files,
+		BufferPool::Buffer& message, std::vector<std::pair<size_t, size_t>>& packed);
+	bool sendPipelined(const std::vector<std::string>& filePaths, std::vector<bool>& validated);
+	bool sendMultiplexed(const std::vector<std::string>& filePaths, std::vector<bool>& validated);
+	size_t stripeCount(const size_t contentSize);
+	bool sendStriped(const BufferPool::Buffer& message, const size_t stripes, ResponseFileAcception& response);
+	bool sendReplicated(const std::string& filePath);
+	static bool sendEncrypted(SocketHandler& socket, const uint8_t* const header, const size_t headerSize,
+		const BufferPool::Buffer& plain, const AESKey& key);
+	template <typename Response>
+	bool validateHeader(const ResponseHeader& header);
+	template <typename Request, typename Response>
+	bool transact(const uint8_t* const message, const size_t size, Response& response);
+	template <typename Request, typename Response>
+	bool transact(const Request& request, Response& response);
+	template <typename Request>
+	bool transact(const Request& request);
+	template <typename Request>
+	bool sendRequest(const Request& request);
+	template <typename Response>
+	bool receiveResponse(Response& response);
+	template <typename Request>
+	stream_t submitRequest(MultiplexedSession& session, const Request& request);
+	template <typename Response>
+	bool parseResponse(const std::vector<uint8_t>& message, Response& response);
+	template <typename Response>
+	static bool checkResponse(Response& response);
+	template <typename Response>
+	static bool exchange(SocketHandler& socket, const uint8_t* const message, const size_t size, Response& response);
+	template <typename Request>
+	static bool exchange(SocketHandler& socket, const Request& request, typename MessageDescriptor<Request>::Response& response);
 
 	Client              _self;           
 	std::stringstream    _lastError;
+	Options              _options;
+	size_t               _pipelineDepth;   // max requests in flight on a single connection. 1 disables pipelining.
+	size_t               _multiplexStreams; // max concurrent file streams of a multiplexed session. 0 disables multiplexing.
+	size_t               _stripeConnections; // parallel connections of a striped upload. 0 - auto, 1 disables striping.
+	ConcurrencyController _concurrency;      // adapts the above limits when enabled.
+	bool                 _speculativeConnect; // connect while the file is being prepared.
+	ServerPool           _servers;            // endpoints listed in SERVER_INFO.
+	size_t               _currentServer;      // index of the server _socketHandler points to.
+	bool                 _serverSelected;     // _currentServer was chosen ahead for a speculative connect.
+	size_t               _sessionServer;      // server holding the client's registration & session key.
+	bool                 _sessionBound;
+	size_t               _sessionMoves;       // failovers which moved the session, to detect requests built before.
+	std::mutex           _rsaMutex;           // guards _rsaDecryptor among worker threads.
+	bool                 _replicate;          // upload each file to all servers.
+	bool                 _stagedUpload;       // read, encrypt & send a file's chunks on separate threads.
+	size_t               _stagedChunkSize;
+	size_t               _stagedQueueDepth;   // chunks between two stages.
+	bool                 _ioUring;            // staged uploads read & send through io_uring where supported.
+	std::unique_ptr<UploadPipeline> _uploadPipeline; // kept across staged uploads, along with its rings & registered buffers.
+	std::map<std::string, Session> _replicaSessions; // per "address:port" of the servers other than the session's, for replicated uploads.
+	std::shared_ptr<CancellationToken> _cancellation; // shared by all sockets of a transfer.
+	std::chrono::milliseconds _transferTimeout; // overall deadline of sendFile & sendFiles. 0 - none.
+	std::string          _syncDirectory;      // tree mirrored by syncDirectory.
+	size_t               _syncScanThreads;
+	DirectoryScanner::EOrder _syncOrder;      // upload order of synced files.
+	std::string          _watchDirectory;     // tree watched by watchDirectory.
+	std::chrono::milliseconds _watchDebounce; // quiet time which ends a batch of landed files.
+	std::chrono::milliseconds _watchMaxDelay; // longest a landed file waits for its batch.
+	size_t               _watchMaxBatch;
+	std::mutex           _watcherMutex;
+	std::shared_ptr<FolderWatcher> _watcher;  // while watchDirectory runs, for cancel().
+	std::atomic<bool>    _stopRequested;      // by cancel(). Batches stop before their next file.
+	bool                 _packSmallFiles;     // batches send small files packed into shared requests.
+	size_t               _packMaxFileSize;    // largest file packed.
+	size_t               _packMaxBytes;       // plain bytes of a packed container.
 	FileHandler* _fileHandler;
 	SocketHandler* _socketHandler;
 	RSAPrivateWrapper* _rsaDecryptor;
@@ -33,6 +33,8 @@ private:
 			MENU_CHANGE_RSA_PAIR = 3,
 			MENU_SEND_PUBLIC_KEY = 4,
 			MENU_SEND_ENCRYPTED_FILE = 5,
+			MENU_SYNC_DIRECTORY = 6,
+			MENU_WATCH_DIRECTORY = 7,
 			MENU_EXIT = 0
 		};
 
@@ -61,6 +63,7 @@ private:
 	void clientStop(const std::string& error) const;
 	std::string readUserInput(const std::string& description = "") const;
 	bool getMenuOption(MenuOption& menuOption) const;
+	bool watchUntilInterrupted();
 
 
 	ClientLogic                   _clientLogic;
@@ -72,6 +75,8 @@ private:
 		{ MenuOption::EOption::MENU_CHANGE_RSA_PAIR,				true,  "Change RSA Pair",				   "RSA pair has been successfully changed."},
 		{ MenuOption::EOption::MENU_SEND_PUBLIC_KEY,				true,  "Send public key",                  "Public key was sent successfully."},
 		{ MenuOption::EOption::MENU_SEND_ENCRYPTED_FILE,            true,  "Send encrypted file",              "Encrypted file was sent successfully. CRC validated with Server."},
+		{ MenuOption::EOption::MENU_SYNC_DIRECTORY,                 true,  "Sync directory",                   "Directory was synced successfully. CRC validated with Server."},
+		{ MenuOption::EOption::MENU_WATCH_DIRECTORY,                true,  "Watch directory",                  "Stopped watching directory."},
 		{ MenuOption::EOption::MENU_EXIT,							false, "Exit client",                      ""}
 	};
 };
@@ -0,0 +1,61 @@
+/**
+ * Encrypted File Transfer Client
+ * @file ConcurrencyController.h
+ * @brief Adaptive limit of concurrent transfers (files in flight, streams or stripes) using AIMD.
+ * The window grows by one per round (window completions) while goodput does not drop, and is halved on latency spikes,
+ * error responses or connection failures. At most one decrease per round, so a burst of failures of the same window
+ * counts once. Spikes & failures count toward the round like any completion, and the latency baseline slowly follows
+ * spiking latency too, so a lasting latency rise (e.g. failover to a farther server) stops counting as spikes.
+ * The window never exceeds the configured maximum last passed to limit(). The current window is published
+ * through Metrics.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+class ConcurrencyController
+{
+public:
+	static constexpr size_t   MIN_WINDOW = 1;
+	static constexpr size_t   MAX_WINDOW = 64;
+	static constexpr size_t   INITIAL_WINDOW = 2;
+	static constexpr double   DECREASE_FACTOR = 0.5;
+	static constexpr double   LATENCY_SPIKE_FACTOR = 2.0;     // latency above factor * baseline is a spike.
+	static constexpr double   SPIKE_BASELINE_GAIN = 0.0625;   // weight of a spike's latency in the baseline.
+	static constexpr double   GOODPUT_TOLERANCE = 0.95;       // keep growing while goodput >= tolerance * previous round.
+	static constexpr uint64_t MIN_LATENCY_BYTES = 65536;      // latency is compared per byte, counting at least this many.
+
+	ConcurrencyController();
+	virtual ~ConcurrencyController() = default;
+	ConcurrencyController(const ConcurrencyController& other) = delete;
+	ConcurrencyController(ConcurrencyController&& other) noexcept = delete;
+	ConcurrencyController& operator=(const ConcurrencyController& other) = delete;
+	ConcurrencyController& operator=(ConcurrencyController&& other) noexcept = delete;
+
+	void enable(const bool enabled);
+	bool isEnabled() const;
+	size_t window() const;
+	size_t limit(const size_t configured);
+
+	void onSuccess(const uint64_t bytes, const uint64_t latencyNanos);
+	void onFailure();
+
+private:
+	void decrease();
+	void complete();
+	void publish() const;
+
+	mutable std::mutex                    _mutex;
+	bool                                  _enabled;
+	size_t                                _window;
+	size_t                                _maximum;           // configured concurrency, the window's ceiling.
+	double                                _baseline;          // smoothed nanoseconds per byte, spikes weighted less.
+	double                                _lastGoodput;       // bytes per second of the previous round.
+	uint64_t                              _roundBytes;
+	size_t                                _roundCompletions;
+	bool                                  _roundDecreased;
+	std::chrono::steady_clock::time_point _roundStart;
+};
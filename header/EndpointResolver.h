@@ -0,0 +1,67 @@
+/**
+ * Encrypted File Transfer Client
+ * @file EndpointResolver.h
+ * @brief Process-wide io_context & cache of resolved server endpoints.
+ * Resolution runs asynchronously on the io_context's thread. Results are cached for a TTL; failures for a shorter
+ * negative TTL, so an unreachable name fails fast. Expired entries are served while being refreshed in the background,
+ * so only the very first lookup of a server waits for the resolver.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class EndpointResolver
+{
+public:
+	using Endpoints = boost::asio::ip::tcp::resolver::results_type;
+
+	static constexpr std::chrono::seconds DEFAULT_TTL{ 60 };
+	static constexpr std::chrono::seconds DEFAULT_NEGATIVE_TTL{ 5 };
+
+	static EndpointResolver& instance();
+
+	virtual ~EndpointResolver();
+	EndpointResolver(const EndpointResolver& other) = delete;
+	EndpointResolver(EndpointResolver&& other) noexcept = delete;
+	EndpointResolver& operator=(const EndpointResolver& other) = delete;
+	EndpointResolver& operator=(EndpointResolver&& other) noexcept = delete;
+
+	boost::asio::io_context& context() { return _context; }
+
+	bool resolve(const std::string& host, const std::string& port, Endpoints& endpoints);
+	void prefetch(const std::string& host, const std::string& port);
+	void setTTL(const std::chrono::seconds ttl, const std::chrono::seconds negativeTTL);
+	void clear();
+
+private:
+	struct Entry
+	{
+		Endpoints                             endpoints;
+		bool                                  resolved = false;    // a result (success or failure) is available.
+		bool                                  failed = false;
+		bool                                  resolving = false;
+		std::chrono::steady_clock::time_point expires;
+	};
+
+	EndpointResolver();
+	void startResolve(const std::string& key, const std::string& host, const std::string& port);  // caller must hold _mutex.
+
+	boost::asio::io_context                                                  _context;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _work;
+	boost::asio::ip::tcp::resolver                                           _resolver;
+	std::thread                                                              _thread;
+	std::mutex                                                               _mutex;
+	std::condition_variable                                                  _resolved;
+	std::map<std::string, Entry>                                             _cache;   // keyed by "host:port".
+	std::chrono::seconds                                                     _ttl;
+	std::chrono::seconds                                                     _negativeTTL;
+};
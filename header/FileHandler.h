@@ -2,16 +2,36 @@
  * Encrypted File Transfer Client
  * @file FileHandler.h
  * @brief Handle files on filesystem.
+ * Large files are read through openSequential(), which on Linux reads a descriptor with a sequential readahead hint
+ * and, by cache mode, drops the pages it consumed from the page cache or bypasses it with O_DIRECT, so bulk uploads
+ * do not evict the rest of the host's cache.
  * @author Arthur Rennert
  */
 
 #pragma once
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <fstream>
+#include "BufferPool.h"
 
 class FileHandler
 {
 public:
+    enum class ECacheMode
+    {
+        CACHE_DEFAULT = 0,    // read pages stay in the page cache.
+        CACHE_DROP_BEHIND,    // read pages are dropped from the page cache once consumed.
+        CACHE_DIRECT          // O_DIRECT reads bypass the page cache. Drop behind where unsupported.
+    };
+
+    static constexpr size_t   DIRECT_ALIGNMENT = 4096;                             // of O_DIRECT offsets, lengths & buffers.
+    static constexpr uint64_t DROP_BEHIND_BYTES = static_cast<uint64_t>(8) << 20;  // dropped from the page cache at once.
+
+    static void setCacheMode(const ECacheMode mode) { _cacheMode.store(mode, std::memory_order_relaxed); }
+    static ECacheMode cacheMode() { return _cacheMode.load(std::memory_order_relaxed); }
+    static bool parseCacheMode(const std::string& name, ECacheMode& mode);
+
     FileHandler();
     virtual ~FileHandler();
 
@@ -23,6 +43,7 @@ public:
 
     // file wrapper functions
     bool open(const std::string& filepath, bool write = false);
+    bool openSequential(const std::string& filepath);
     bool openToAppend(const std::string& filepath);
     void close();
     bool read(uint8_t* const dest, const size_t bytes) const;
@@ -31,9 +52,24 @@ public:
     bool writeLine(const std::string& line) const;
     size_t size() const;
 
-    bool readAtOnce(const std::string& filepath, uint8_t*& file, size_t& bytes);
+    // descriptor of a file opened by openSequential. -1 otherwise.
+    int descriptor() const { return _descriptor; }
+    bool isDirect() const { return _direct; }
+    void disableDirect() const;
+    void dropBehind(const uint64_t offset) const;
+
+    bool readAtOnce(const std::string& filepath, BufferPool::Buffer& file);
 
 private:
-    std::fstream* _fileStream;
-    bool          _open;  // indicates whether a file is open.
+    bool readDescriptor(uint8_t* const dest, const size_t bytes) const;
+
+    static std::atomic<ECacheMode> _cacheMode;
+
+    std::fstream*    _fileStream;
+    bool             _open;        // indicates whether a file is open.
+    int              _descriptor;  // file opened by openSequential.
+    mutable uint64_t _offset;      // read position of _descriptor.
+    mutable uint64_t _dropped;     // bytes dropped from the page cache so far.
+    mutable bool     _direct;      // reads bypass the page cache.
+    mutable bool     _dropBehind;  // drop read pages from the page cache.
 };
@@ -0,0 +1,67 @@
+/**
+ * Encrypted File Transfer Client
+ * @file FolderWatcher.h
+ * @brief Watch a directory tree with Linux inotify for files which finished landing, and hand them out in batches.
+ * A file is queued once closed after writing (IN_CLOSE_WRITE) or moved into the tree (IN_MOVED_TO), and dropped again
+ * if deleted or moved away before its batch is handed out. Bursts are coalesced: a batch is handed out once no file
+ * landed for the debounce time, once its first file waited maxDelay, or once it holds maxBatch files.
+ * A file handed out before can be requeued after a delay, e.g. to back off from a failed upload.
+ * The watcher blocks on inotify's descriptor between events; nothing is polled. If the kernel's event queue overflows,
+ * the tree is rescanned for files written since watching started.
+ * Subdirectories created later are watched too. Symbolic links are not followed.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class FolderWatcher
+{
+public:
+	static constexpr std::chrono::milliseconds DEFAULT_DEBOUNCE{ 50 };
+	static constexpr std::chrono::milliseconds DEFAULT_MAX_DELAY{ 250 };
+	static constexpr size_t                    DEFAULT_MAX_BATCH = 256;
+
+	FolderWatcher(const std::chrono::milliseconds debounce, const std::chrono::milliseconds maxDelay, const size_t maxBatch);
+	virtual ~FolderWatcher();
+	FolderWatcher(const FolderWatcher& other) = delete;
+	FolderWatcher(FolderWatcher&& other) noexcept = delete;
+	FolderWatcher& operator=(const FolderWatcher& other) = delete;
+	FolderWatcher& operator=(FolderWatcher&& other) noexcept = delete;
+
+	bool open(const std::string& directory);
+	bool nextBatch(std::vector<std::string>& paths, std::chrono::steady_clock::time_point& landed);
+	void requeue(const std::string& path, const std::chrono::milliseconds delay);
+	void stop();
+	bool isStopped() const { return _stopped.load(std::memory_order_acquire); }
+	size_t overflows() const { return _overflows; }
+
+private:
+	bool readEvents();
+	void watchTree(const std::string& directory, const bool queueFiles);
+	void unwatchTree(const std::string& directory);
+	void queue(const std::string& path);
+	std::chrono::steady_clock::time_point queueDelayed(const std::chrono::steady_clock::time_point& now);
+	void rescan();
+
+	std::chrono::milliseconds             _debounce;
+	std::chrono::milliseconds             _maxDelay;
+	size_t                                _maxBatch;
+	std::string                           _root;
+	int                                   _inotify;
+	int                                   _wake;          // eventfd signalled by stop().
+	std::atomic<bool>                     _stopped;
+	std::map<int, std::string>            _directories;   // watch descriptor -> watched directory.
+	std::map<std::string, uint64_t>       _pending;       // path -> landing order.
+	std::map<std::string, std::chrono::steady_clock::time_point> _delayed;  // requeued path -> due.
+	uint64_t                              _sequence;
+	std::chrono::steady_clock::time_point _first;         // first file of the pending batch landed.
+	std::chrono::steady_clock::time_point _last;          // last file of the pending batch landed.
+	int64_t                               _started;       // watching started, in nanoseconds since epoch.
+	size_t                                _overflows;
+};
@@ -0,0 +1,53 @@
+/**
+ * Encrypted File Transfer Client
+ * @file IoUring.h
+ * @brief Thin wrapper of a Linux io_uring instance (liburing) with registered buffers.
+ * Operations are queued with prepare*() and submitted in a single system call by submitAndWait(), which also reaps
+ * their completions. An instance must be used by one thread at a time.
+ * Compiled in when EFT_IO_URING is defined (link with -luring). Otherwise, or if the kernel lacks io_uring,
+ * isSupported() is false and callers keep their portable path.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+class IoUring
+{
+public:
+	struct Completion
+	{
+		uint64_t userData = 0;
+		int32_t  result = 0;     // bytes transferred, or -errno.
+
+		bool isCancelled() const { return result == -ECANCELED; }  // a linked operation before it failed.
+	};
+
+	static constexpr int UNREGISTERED = -1;   // buffer index of memory not registered with the ring.
+
+	static bool isSupported();
+
+	explicit IoUring(const unsigned entries);
+	virtual ~IoUring();
+	IoUring(const IoUring& other) = delete;
+	IoUring(IoUring&& other) noexcept = delete;
+	IoUring& operator=(const IoUring& other) = delete;
+	IoUring& operator=(IoUring&& other) noexcept = delete;
+
+	bool isReady() const { return _impl != nullptr; }
+	unsigned entries() const { return _entries; }
+	bool registerBuffers(const std::vector<std::span<uint8_t>>& buffers);
+
+	bool prepareRead(const int fd, const int buffer, uint8_t* const dest, const size_t length, const uint64_t offset, const uint64_t userData);
+	bool prepareWrite(const int fd, const int buffer, const uint8_t* const src, const size_t length, const bool link, const uint64_t userData);
+	bool submitAndWait(const size_t count, std::vector<Completion>& completions);
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> _impl;    // null if io_uring is unavailable.
+	unsigned              _entries;
+};
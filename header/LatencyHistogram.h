@@ -0,0 +1,47 @@
+/**
+ * Encrypted File Transfer Client
+ * @file LatencyHistogram.h
+ * @brief Lock-free log-linear (HDR style) histogram of latencies in nanoseconds.
+ * Each power of two is split into SUB_BUCKETS linear buckets, which bounds the relative error to 1 / SUB_BUCKETS.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+class LatencyHistogram
+{
+public:
+	static constexpr size_t   SUB_BUCKET_BITS = 5;
+	static constexpr size_t   SUB_BUCKETS = static_cast<size_t>(1) << SUB_BUCKET_BITS;
+	static constexpr size_t   MAX_EXPONENT = 40;   // 2^40 ns is ~18 minutes. Longer latencies are clamped.
+	static constexpr size_t   BUCKETS = SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	LatencyHistogram();
+	virtual ~LatencyHistogram() = default;
+	LatencyHistogram(const LatencyHistogram& other) = delete;
+	LatencyHistogram(LatencyHistogram&& other) noexcept = delete;
+	LatencyHistogram& operator=(const LatencyHistogram& other) = delete;
+	LatencyHistogram& operator=(LatencyHistogram&& other) noexcept = delete;
+
+	void record(const uint64_t nanos);
+	void reset();
+
+	uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+	uint64_t min() const;
+	uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+	uint64_t mean() const;
+	uint64_t percentile(const double percent) const;
+
+private:
+	static size_t bucketIndex(const uint64_t value);
+	static uint64_t bucketHighest(const size_t index);
+
+	std::array<std::atomic<uint64_t>, BUCKETS> _buckets;
+	std::atomic<uint64_t>                      _count;
+	std::atomic<uint64_t>                      _sum;
+	std::atomic<uint64_t>                      _min;
+	std::atomic<uint64_t>                      _max;
+};
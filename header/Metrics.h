@@ -0,0 +1,209 @@
+/**
+ * Encrypted File Transfer Client
+ * @file Metrics.h
+ * @brief Per-phase timings & byte counts of client operations.
+ * Recording is done through TransferScope & PhaseScope. Both do nothing while metrics are disabled.
+ * Request latencies are always recorded into lock-free histograms, keyed by RequestCode.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include "protocol.h"
+#include "LatencyHistogram.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+class Metrics
+{
+public:
+	enum class EPhase
+	{
+		PHASE_CONNECT = 0,
+		PHASE_READ,
+		PHASE_CRC,
+		PHASE_ENCRYPT,
+		PHASE_ASSEMBLE,
+		PHASE_SEND,
+		PHASE_RESPONSE_WAIT,
+		PHASE_DECRYPT,
+		PHASE_COUNT
+	};
+	static constexpr size_t PHASES = static_cast<size_t>(EPhase::PHASE_COUNT);
+
+	enum class ELatency
+	{
+		LATENCY_CONNECT = 0,
+		LATENCY_SEND,
+		LATENCY_RESPONSE_WAIT,
+		LATENCY_ROUND_TRIP,
+		LATENCY_COUNT
+	};
+	static constexpr size_t LATENCIES = static_cast<size_t>(ELatency::LATENCY_COUNT);
+
+	enum class ETimeout
+	{
+		TIMEOUT_CONNECT = 0,
+		TIMEOUT_SEND,
+		TIMEOUT_RECEIVE,
+		TIMEOUT_TRANSFER,    // overall deadline of a transfer.
+		TIMEOUT_CANCELLED,   // aborted by cancellation rather than a timeout.
+		TIMEOUT_COUNT
+	};
+	static constexpr size_t TIMEOUTS = static_cast<size_t>(ETimeout::TIMEOUT_COUNT);
+
+	// Queues between the stages of a staged upload, named by the stage which fills them.
+	enum class EQueue
+	{
+		QUEUE_READ = 0,      // reader -> crypto.
+		QUEUE_CRYPTO,        // crypto -> sender.
+		QUEUE_COUNT
+	};
+	static constexpr size_t QUEUES = static_cast<size_t>(EQueue::QUEUE_COUNT);
+
+	// Occupancy seen by a queue's consumer. Mostly full - the consumer is the bottleneck, mostly empty - the producer.
+	struct QueueOccupancy
+	{
+		uint64_t samples = 0;
+		uint64_t total = 0;
+		uint64_t max = 0;
+		uint64_t capacity = 0;
+	};
+
+	struct Transfer
+	{
+		const char*                  operation = "";
+		bool                         success = false;
+		uint64_t                     totalNanos = 0;
+		std::array<uint64_t, PHASES> nanos{};
+		std::array<uint64_t, PHASES> bytes{};
+	};
+
+	struct Totals
+	{
+		uint64_t                     transfers = 0;
+		uint64_t                     failures = 0;
+		uint64_t                     totalNanos = 0;
+		std::array<uint64_t, PHASES> nanos{};
+		std::array<uint64_t, PHASES> bytes{};
+	};
+
+	// Records a single operation (e.g. sendFile) on the current thread.
+	class TransferScope
+	{
+	public:
+		explicit TransferScope(const char* operation);
+		virtual ~TransferScope();
+		TransferScope(const TransferScope& other) = delete;
+		TransferScope& operator=(const TransferScope& other) = delete;
+
+		void setSuccess(const bool success) { _transfer.success = success; }
+
+	private:
+		Transfer                              _transfer;
+		Transfer*                             _previous;
+		bool                                  _active;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	// Adds elapsed time & bytes of a phase to the transfer recorded on the current thread.
+	class PhaseScope
+	{
+	public:
+		explicit PhaseScope(const EPhase phase, const uint64_t bytes = 0);
+		virtual ~PhaseScope();
+		PhaseScope(const PhaseScope& other) = delete;
+		PhaseScope& operator=(const PhaseScope& other) = delete;
+
+		void addBytes(const uint64_t bytes) { _bytes += bytes; }
+
+	private:
+		Transfer*                             _transfer;
+		size_t                                _phase;
+		uint64_t                              _bytes;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	static Metrics& instance();
+	static const char* phaseName(const EPhase phase);
+	static const char* latencyName(const ELatency latency);
+	static const char* timeoutName(const ETimeout timeout);
+	static const char* queueName(const EQueue queue);
+	static uint64_t elapsedNanos(const std::chrono::steady_clock::time_point& since);
+	static void addPhase(const EPhase phase, const uint64_t nanos, const uint64_t bytes);
+
+	virtual ~Metrics();
+	Metrics(const Metrics& other) = delete;
+	Metrics(Metrics&& other) noexcept = delete;
+	Metrics& operator=(const Metrics& other) = delete;
+	Metrics& operator=(Metrics&& other) noexcept = delete;
+
+	void enable(const bool enabled) { _enabled.store(enabled, std::memory_order_relaxed); }
+	bool isEnabled() const { return _enabled.load(std::memory_order_relaxed); }
+	void setJsonOutput(const std::string& path);
+	void setPrometheusOutput(const std::string& path);
+	void setLatencyOutput(const std::string& path);
+
+	std::map<std::string, Totals> totals() const;
+	Transfer lastTransfer() const;
+
+	void recordLatency(const code_t code, const ELatency latency, const uint64_t nanos);
+	const LatencyHistogram& latency(const code_t code, const ELatency latency) const;
+	void dumpLatency(std::ostream& os) const;
+
+	// Current adaptive concurrency window. 0 while adaptive concurrency is disabled.
+	void setConcurrencyWindow(const size_t window) { _concurrencyWindow.store(window, std::memory_order_relaxed); }
+	size_t concurrencyWindow() const { return _concurrencyWindow.load(std::memory_order_relaxed); }
+
+	// Socket operations aborted by a deadline or a cancellation.
+	void recordTimeout(const ETimeout timeout) { _timeouts[static_cast<size_t>(timeout)].fetch_add(1, std::memory_order_relaxed); }
+	uint64_t timeouts(const ETimeout timeout) const { return _timeouts[static_cast<size_t>(timeout)].load(std::memory_order_relaxed); }
+
+	void recordQueueOccupancy(const EQueue queue, const size_t occupancy, const size_t capacity);
+	QueueOccupancy queueOccupancy(const EQueue queue) const;
+
+	// File bytes read through the page cache or bypassing it (O_DIRECT), and read bytes dropped from the page cache.
+	void recordFileRead(const uint64_t bytes, const bool direct) { (direct ? _directReadBytes : _cachedReadBytes).fetch_add(bytes, std::memory_order_relaxed); }
+	uint64_t fileReadBytes(const bool direct) const { return (direct ? _directReadBytes : _cachedReadBytes).load(std::memory_order_relaxed); }
+	void recordCacheDropped(const uint64_t bytes) { _cacheDroppedBytes.fetch_add(bytes, std::memory_order_relaxed); }
+	uint64_t cacheDroppedBytes() const { return _cacheDroppedBytes.load(std::memory_order_relaxed); }
+
+private:
+	Metrics() : _enabled(false), _concurrencyWindow(0), _cachedReadBytes(0), _directReadBytes(0), _cacheDroppedBytes(0) {}
+	void record(const Transfer& transfer);
+	void writeJsonLine(const Transfer& transfer) const;
+	void writePrometheus() const;
+	static size_t requestIndex(const code_t code);
+
+	static thread_local Transfer* _current;
+
+	std::atomic<bool>             _enabled;
+	std::atomic<size_t>           _concurrencyWindow;
+	std::array<std::atomic<uint64_t>, TIMEOUTS> _timeouts{};
+	std::atomic<uint64_t>         _cachedReadBytes;
+	std::atomic<uint64_t>         _directReadBytes;
+	std::atomic<uint64_t>         _cacheDroppedBytes;
+
+	struct QueueCounters
+	{
+		std::atomic<uint64_t> samples{ 0 };
+		std::atomic<uint64_t> total{ 0 };
+		std::atomic<uint64_t> max{ 0 };
+		std::atomic<uint64_t> capacity{ 0 };
+	};
+	std::array<QueueCounters, QUEUES> _queues;
+	mutable std::mutex            _mutex;
+	std::string                   _jsonPath;
+	std::string                   _prometheusPath;
+	std::string                   _latencyPath;
+	std::map<std::string, Totals> _totals;
+	Transfer                      _last;
+
+	// One row per REQUEST_CODES entry. Last row collects unknown codes.
+	std::array<std::array<LatencyHistogram, LATENCIES>, REQUEST_OPTIONS + 1> _latency;
+};
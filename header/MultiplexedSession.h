@@ -0,0 +1,70 @@
+/**
+ * Encrypted File Transfer Client
+ * @file MultiplexedSession.h
+ * @brief Multiplex several requests over a single connection (protocol version 4).
+ * The connection is upgraded by a classic request first (see open), so a server tells it from classic connections
+ * by the request code, and an older server refuses it instead of misreading frames.
+ * Each request is a stream, chunked into frames of at most FRAME_PAYLOAD_SIZE bytes. Frames of different streams
+ * interleave, the stream with the fewest bytes left goes first, so small requests are not stuck behind large uploads.
+ * Each stream may send up to its window, which the server extends with WINDOW_UPDATE frames.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include "protocol.h"
+#include "BufferPool.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+class SocketHandler;
+
+class MultiplexedSession
+{
+public:
+	struct Completion
+	{
+		stream_t             streamId = 0;
+		bool                 reset = false;   // aborted by the server. response is empty.
+		uint64_t             requestBytes = 0;
+		uint64_t             latencyNanos = 0; // from submit until completion.
+		std::vector<uint8_t> response;        // reassembled response in wire byte order. Empty if none expected.
+	};
+
+	explicit MultiplexedSession(SocketHandler& socket);
+	virtual ~MultiplexedSession() = default;
+	MultiplexedSession(const MultiplexedSession& other) = delete;
+	MultiplexedSession(MultiplexedSession&& other) noexcept = delete;
+	MultiplexedSession& operator=(const MultiplexedSession& other) = delete;
+	MultiplexedSession& operator=(MultiplexedSession&& other) noexcept = delete;
+
+	bool open(const ClientID& clientId);
+	stream_t submit(BufferPool::Buffer&& message, const bool expectResponse);
+	stream_t submit(const uint8_t* const message, const size_t size, const bool expectResponse);
+	size_t outstanding() const { return _streams.size() + _completed.size(); }
+	bool next(Completion& completion);
+
+private:
+	struct Stream
+	{
+		BufferPool::Buffer                    message;   // request in wire byte order.
+		size_t                                sent = 0;
+		csize_t                               window = INITIAL_STREAM_WINDOW;
+		bool                                  expectResponse = true;
+		code_t                                code = DEFAULT_VALUE;
+		std::chrono::steady_clock::time_point submittedAt;
+		std::vector<uint8_t>                  response;
+	};
+
+	stream_t nextSendable() const;
+	bool sendFrame(const stream_t streamId, Stream& stream);
+	bool receiveFrame();
+	void complete(const stream_t streamId, const bool reset);
+
+	SocketHandler&               _socket;
+	stream_t                     _nextStreamId;
+	std::map<stream_t, Stream>   _streams;
+	std::deque<Completion>       _completed;
+};
@@ -0,0 +1,31 @@
+/**
+ * Encrypted File Transfer Client
+ * @file Options.h
+ * @brief Optional client settings. Parsed from "key = value" lines.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class Options
+{
+public:
+	Options() = default;
+	virtual ~Options() = default;
+
+	bool parseLine(const std::string& line);
+	bool parseFile(const std::string& path, const bool required = false);
+
+	bool contains(const std::string& key) const;
+	std::string getString(const std::string& key, const std::string& defaultValue = "") const;
+	uint64_t getUInt(const std::string& key, const uint64_t defaultValue = 0) const;
+	bool getBool(const std::string& key, const bool defaultValue = false) const;
+	std::vector<std::string> keys(const std::string& prefix) const;
+
+private:
+	std::map<std::string, std::string> _values;
+};
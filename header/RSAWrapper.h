@@ -8,6 +8,7 @@
 #pragma once
 #include <osrng.h>
 #include <rsa.h>
+#include <span>
 #include <string>
 #include "protocol.h"
 
@@ -57,4 +58,5 @@ public:
 	std::string getPublicKey() const;
 
 	std::string decrypt(const uint8_t* cipher, size_t length);
+	size_t decrypt(std::span<const uint8_t> cipher, std::span<uint8_t> plain);
 };
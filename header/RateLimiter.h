@@ -0,0 +1,73 @@
+/**
+ * Encrypted File Transfer Client
+ * @file RateLimiter.h
+ * @brief Token bucket bandwidth shaping of outgoing traffic, globally and per server.
+ * Senders acquire tokens for small chunks (PACING_QUANTUM) and sleep just long enough for the bucket to cover them,
+ * so traffic is paced smoothly instead of in bursts followed by long sleeps. burst bounds the tokens saved while idle.
+ * Limits can be changed at runtime through the setters, or by reloading the options file upon SIGHUP (SIGBREAK on Windows).
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+class Options;
+
+class RateLimiter
+{
+public:
+	static constexpr size_t   PACING_QUANTUM = 16384;        // bytes sent per token acquisition.
+	static constexpr uint64_t MIN_BURST = 65536;             // default burst is the greater of this & 100ms of traffic.
+
+	static RateLimiter& instance();
+
+	virtual ~RateLimiter() = default;
+	RateLimiter(const RateLimiter& other) = delete;
+	RateLimiter(RateLimiter&& other) noexcept = delete;
+	RateLimiter& operator=(const RateLimiter& other) = delete;
+	RateLimiter& operator=(RateLimiter&& other) noexcept = delete;
+
+	// rate in bytes per second. 0 removes the limit. burst 0 selects the default.
+	void setGlobalLimit(const uint64_t rate, const uint64_t burst = 0);
+	void setServerLimit(const std::string& server, const uint64_t rate, const uint64_t burst = 0);
+	void configure(const Options& options);
+
+	bool isEnabled() const { return _enabled.load(std::memory_order_relaxed) || _reloadRequested.load(std::memory_order_relaxed); }
+	void acquire(const std::string& server, const size_t bytes);
+
+	// Re-read limits from path upon requestReload(). requestReload() is async signal safe.
+	void setReloadSource(const std::string& path);
+	void requestReload() { _reloadRequested.store(true, std::memory_order_relaxed); }
+	static void installReloadSignal();
+
+private:
+	class TokenBucket
+	{
+	public:
+		void setLimit(const uint64_t rate, const uint64_t burst);
+		bool isLimited() const { return _rate > 0; }
+		uint64_t reserve(const size_t bytes, const std::chrono::steady_clock::time_point& now);
+
+	private:
+		double                                _rate = 0;     // bytes per second.
+		double                                _burst = 0;
+		double                                _tokens = 0;   // negative while reserved ahead.
+		std::chrono::steady_clock::time_point _last = std::chrono::steady_clock::now();
+	};
+
+	RateLimiter() : _enabled(false), _reloadRequested(false) {}
+	void reload();
+	void updateEnabled();  // caller must hold _mutex.
+
+	std::atomic<bool>                  _enabled;
+	std::atomic<bool>                  _reloadRequested;
+	std::mutex                         _mutex;
+	TokenBucket                        _global;
+	std::map<std::string, TokenBucket> _servers;   // keyed by "address:port".
+	std::string                        _reloadPath;
+};
@@ -0,0 +1,66 @@
+/**
+ * Encrypted File Transfer Client
+ * @file Serializer.h
+ * @brief Convert protocol messages between host & wire (little endian) byte order.
+ * Only the multi-byte integer fields listed by WireLayout are converted. Byte arrays & bulk payload are untouched.
+ * On little endian hosts every conversion compiles to nothing.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include "protocol.h"
+#include <bit>
+#include <cstring>
+
+class Serializer
+{
+public:
+	static constexpr bool NATIVE_WIRE_ORDER = (std::endian::native == std::endian::little);
+
+	// Convert a single value. Conversion is symmetric.
+	template <typename T>
+	static constexpr T wire(const T value)
+	{
+		if constexpr (NATIVE_WIRE_ORDER || sizeof(T) == 1)
+			return value;
+		else
+			return swap(value);
+	}
+
+	// Convert Message's integer fields in place. buffer holds a Message (possibly followed by payload).
+	template <typename Message>
+	static void toWire(uint8_t* const buffer)
+	{
+		if constexpr (!NATIVE_WIRE_ORDER)
+		{
+			for (const auto& field : WireLayout<Message>::fields)
+				swapField(buffer + field.offset, field.size);
+		}
+	}
+
+	template <typename Message>
+	static void fromWire(uint8_t* const buffer)
+	{
+		toWire<Message>(buffer);
+	}
+
+private:
+	template <typename T>
+	static constexpr T swap(const T value)
+	{
+		T result = 0;
+		for (size_t i = 0; i < sizeof(T); ++i)
+			result |= static_cast<T>(((value >> (8 * i)) & 0xFF) << (8 * (sizeof(T) - 1 - i)));
+		return result;
+	}
+
+	static void swapField(uint8_t* const field, const size_t size)
+	{
+		for (size_t i = 0; i < size / 2; ++i)
+		{
+			const uint8_t tmp = field[i];
+			field[i] = field[size - 1 - i];
+			field[size - 1 - i] = tmp;
+		}
+	}
+};
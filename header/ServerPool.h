@@ -0,0 +1,76 @@
+/**
+ * Encrypted File Transfer Client
+ * @file ServerPool.h
+ * @brief List of server endpoints with health tracking & load balancing.
+ * A server which fails to connect is skipped until its backoff expires. Backoff grows exponentially with consecutive
+ * failures and is jittered, so clients do not retry a recovering server in lockstep.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include "protocol.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+class ServerPool
+{
+public:
+	enum class EStrategy
+	{
+		ROUND_ROBIN = 0,
+		LEAST_OUTSTANDING,
+		CONSISTENT_HASH     // by ClientID. A client sticks to the same server while it is healthy.
+	};
+
+	struct Server
+	{
+		std::string                           address;
+		std::string                           port;
+		size_t                                outstanding = 0;   // requests in progress.
+		size_t                                failures = 0;      // consecutive connect failures.
+		std::chrono::steady_clock::time_point retryAt;           // skipped until then.
+	};
+
+	static constexpr std::chrono::milliseconds BASE_BACKOFF{ 100 };
+	static constexpr std::chrono::milliseconds MAX_BACKOFF{ 30000 };
+	static constexpr size_t                    VIRTUAL_NODES = 64;   // hash ring points per server.
+
+	ServerPool();
+	virtual ~ServerPool() = default;
+	ServerPool(const ServerPool& other) = delete;
+	ServerPool(ServerPool&& other) noexcept = delete;
+	ServerPool& operator=(const ServerPool& other) = delete;
+	ServerPool& operator=(ServerPool&& other) noexcept = delete;
+
+	static bool parseStrategy(const std::string& name, EStrategy& strategy);
+
+	void add(const std::string& address, const std::string& port);
+	void clear();
+	size_t size() const;
+	Server server(const size_t index) const;
+	void setStrategy(const EStrategy strategy);
+
+	size_t select(const ClientID& clientId);
+	bool isHealthy(const size_t index) const;
+	void onConnected(const size_t index);
+	void onFailure(const size_t index);
+	void onCompleted(const size_t index);
+	std::chrono::steady_clock::duration timeUntilHealthy() const;
+
+private:
+	bool isHealthy(const Server& server, const std::chrono::steady_clock::time_point& now) const;
+	size_t selectConsistent(const ClientID& clientId, const std::chrono::steady_clock::time_point& now) const;
+	void rebuildRing();
+	static uint64_t hash(const uint8_t* data, const size_t size);
+
+	mutable std::mutex                        _mutex;
+	std::vector<Server>                       _servers;
+	std::vector<std::pair<uint64_t, size_t>>  _ring;      // sorted (point, server index).
+	EStrategy                                 _strategy;
+	size_t                                    _next;      // round robin position.
+	std::mt19937                              _random;    // backoff jitter.
+};
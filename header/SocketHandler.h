@@ -7,18 +7,52 @@
 
 #pragma once
 #include <string>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
 #include <ostream>
 #include <boost/asio/ip/tcp.hpp>
+#include "protocol.h"
 
 using boost::asio::ip::tcp;
 using boost::asio::io_context;
 
+class CancellationToken;
+
 constexpr size_t PACKET_SIZE = 1024;   // The same on server side.
+constexpr size_t MIN_SOCKET_BUFFER = static_cast<size_t>(64) << 10;
+constexpr size_t MAX_SOCKET_BUFFER = static_cast<size_t>(16) << 20;
+constexpr size_t SEND_TIMEOUT_CHUNK = static_cast<size_t>(1) << 20;
 
 class SocketHandler
 {
 public:
+	// Socket options applied upon connect. Shared by all sockets.
+	struct Tuning
+	{
+		bool   noDelay = true;        // TCP_NODELAY. Requests are written whole, so Nagle only delays them.
+		bool   autoBuffers = false;   // size SO_SNDBUF/SO_RCVBUF from the measured bandwidth-delay product.
+		size_t sendBuffer = 0;        // SO_SNDBUF. 0 keeps the kernel default.
+		size_t receiveBuffer = 0;     // SO_RCVBUF. 0 keeps the kernel default.
+		bool   cork = false;          // TCP_CORK around a request's packets (Linux only).
+		bool   fastOpen = false;      // TCP Fast Open: the SYN carries the first request bytes (Linux only).
+	};
+
+	// Longest a blocking operation may take. Zero waits forever. Shared by all sockets.
+	struct Timeouts
+	{
+		std::chrono::milliseconds connect{ 0 };
+		std::chrono::milliseconds send{ 0 };      // per write of up to SEND_TIMEOUT_CHUNK bytes, so large files are not cut short.
+		std::chrono::milliseconds receive{ 0 };
+	};
+
+	static void setTuning(const Tuning& tuning);
+	static void setTimeouts(const Timeouts& timeouts);
+	static size_t bandwidthDelayProduct();
+
 	SocketHandler();
 	virtual ~SocketHandler();
 
@@ -37,6 +71,14 @@ public:
 		return operator<<(os, &socket);
 	}
 
+	// inline getters
+	const std::string& getAddress() const { return _address; }
+	const std::string& getPort() const { return _port; }
+	bool isConnected() const { return _connected; }
+
+	// Operations are aborted upon cancellation or once the token's deadline passes. Applies from the next connect.
+	void setCancellation(std::shared_ptr<CancellationToken> cancellation) { _cancellation = std::move(cancellation); }
+
 	// validations
 	static bool isValidAddress(const std::string& address);
 	static bool isValidPort(const std::string& port);
@@ -44,20 +86,48 @@ public:
 	// logic
 	bool setSocketInfo(const std::string& address, const std::string& port);
 	bool connect();
+	void preconnect();
 	void close();
 	bool receive(uint8_t* const buffer, const size_t size) const;
+	bool receiveResponse(uint8_t* const response, const size_t resSize, size_t& received) const;
 	bool send(const uint8_t* const buffer, const size_t size) const;
+	bool send(const uint8_t* const header, const size_t headerSize, const uint8_t* const body, const size_t bodySize) const;
+	bool sendUnpadded(const uint8_t* const header, const size_t headerSize, const uint8_t* const body, const size_t bodySize) const;
+	bool sendWith(const std::function<bool(const tcp::socket::native_handle_type)>& writer, const size_t bytes) const;
+	bool hasPendingInput() const;
 	bool sendReceive(const uint8_t* const toSend, const size_t size, uint8_t* const response, const size_t resSize);
+	bool sendReceive(const uint8_t* const header, const size_t headerSize, const uint8_t* const body, const size_t bodySize,
+		uint8_t* const response, const size_t resSize);
 	bool sendOnly(const uint8_t* const toSend, const size_t size);
 
 private:
 	std::string     _address;
 	std::string     _port;
-	io_context*		_ioContext;
-	tcp::resolver*  _resolver;
 	tcp::socket*	_socket;
-	bool		    _bigEndian;
 	bool            _connected;  // indicates that socket is open and connected.
+	std::future<bool> _preconnect; // speculative connect in progress or done, not yet used.
+	std::shared_ptr<CancellationToken> _cancellation;
+	std::shared_ptr<CancellationToken> _subscribed;   // token the connection is subscribed to, until closed.
+	size_t          _subscription;
+
+	struct Connection;
+	class Watchdog;
+	std::shared_ptr<Connection> _connection;  // target of aborts, shared with their pending handlers.
+
+	static code_t requestCode(const uint8_t* const buffer, const size_t size);
+	bool receive(uint8_t* const buffer, const size_t size, size_t& received) const;
+	bool isAlive() const;
+	bool establish();
+	bool adoptPreconnected();
+	void closeSocket();
+	void applyTuning() const;
+	void applyBuffers() const;
+	void setCork(const bool cork) const;
+	static void postAbort(const std::shared_ptr<Connection>& connection);
+	static void updateEstimate(std::atomic<uint64_t>& estimate, const uint64_t sample);
 
-	void swapBytes(uint8_t* const buffer, size_t size) const;
+	static Tuning                _tuning;      // set before connecting.
+	static Timeouts              _timeouts;
+	static std::atomic<uint64_t> _rttNanos;    // smoothed connect time, as round trip estimate.
+	static std::atomic<uint64_t> _bandwidth;   // smoothed bytes per second of large sends.
 };
@@ -0,0 +1,123 @@
+/**
+ * Encrypted File Transfer Client
+ * @file SpscRing.h
+ * @brief Bounded lock-free ring between a single producer thread and a single consumer thread.
+ * Indices run freely. Only the consumer writes _head and only the producer writes _tail, each on its own cache line.
+ * A full ring blocks the producer (backpressure) and an empty ring blocks the consumer. Both wait on an event counter
+ * which every push, pop & close advances. Either side may close the ring: the producer once done, the consumer to abort.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SpscRing
+{
+public:
+	static constexpr size_t CACHE_LINE = 64;
+
+	explicit SpscRing(const size_t capacity) : _slots(roundUp(capacity)), _mask(roundUp(capacity) - 1),
+		_head(0), _tail(0), _events(0), _closed(false) {}
+	virtual ~SpscRing() = default;
+	SpscRing(const SpscRing& other) = delete;
+	SpscRing(SpscRing&& other) noexcept = delete;
+	SpscRing& operator=(const SpscRing& other) = delete;
+	SpscRing& operator=(SpscRing&& other) noexcept = delete;
+
+	size_t capacity() const { return _slots.size(); }
+	size_t size() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire); }
+	bool isClosed() const { return _closed.load(std::memory_order_acquire); }
+
+	/**
+	 * Producer: move item in, waiting while the ring is full. Return false if the ring was closed.
+	 */
+	bool push(T&& item)
+	{
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const uint32_t events = _events.load(std::memory_order_acquire);
+			if (_closed.load(std::memory_order_acquire))
+				return false;
+			if (tail - _head.load(std::memory_order_acquire) < _slots.size())
+				break;
+			_events.wait(events, std::memory_order_acquire);
+		}
+		_slots[tail & _mask] = std::move(item);
+		_tail.store(tail + 1, std::memory_order_release);
+		signal();
+		return true;
+	}
+
+	/**
+	 * Consumer: move the oldest item out, waiting while the ring is empty.
+	 * Items pushed before close are still popped. Return false once the ring is closed and empty.
+	 */
+	bool pop(T& item)
+	{
+		const size_t head = _head.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const uint32_t events = _events.load(std::memory_order_acquire);
+			if (_tail.load(std::memory_order_acquire) != head)
+				break;
+			if (_closed.load(std::memory_order_acquire))
+				return false;
+			_events.wait(events, std::memory_order_acquire);
+		}
+		item = std::move(_slots[head & _mask]);
+		_head.store(head + 1, std::memory_order_release);
+		signal();
+		return true;
+	}
+
+	/**
+	 * Consumer: move the oldest item out if there is one. Does not wait.
+	 */
+	bool tryPop(T& item)
+	{
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if (_tail.load(std::memory_order_acquire) == head)
+			return false;
+		item = std::move(_slots[head & _mask]);
+		_head.store(head + 1, std::memory_order_release);
+		signal();
+		return true;
+	}
+
+	/**
+	 * Stop the ring. A blocked push returns false & a blocked pop returns once the ring is drained.
+	 */
+	void close()
+	{
+		_closed.store(true, std::memory_order_release);
+		signal();
+	}
+
+private:
+	static size_t roundUp(const size_t capacity)
+	{
+		size_t result = 1;
+		while (result < capacity)
+			result <<= 1;
+		return result;
+	}
+
+	void signal()
+	{
+		_events.fetch_add(1, std::memory_order_release);
+		_events.notify_all();
+	}
+
+	std::vector<T>                              _slots;
+	const size_t                                _mask;
+	alignas(CACHE_LINE) std::atomic<size_t>     _head;     // next slot to pop.
+	alignas(CACHE_LINE) std::atomic<size_t>     _tail;     // next slot to push.
+	alignas(CACHE_LINE) std::atomic<uint32_t>   _events;   // advanced on every state change, to wait on.
+	std::atomic<bool>                           _closed;
+};
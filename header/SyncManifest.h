@@ -0,0 +1,40 @@
+/**
+ * Encrypted File Transfer Client
+ * @file SyncManifest.h
+ * @brief Size & last write time of each file uploaded by directory sync, so later syncs upload new or changed files only.
+ * Stored as "size<TAB>modified<TAB>path" lines.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class SyncManifest
+{
+public:
+	SyncManifest() = default;
+	virtual ~SyncManifest() = default;
+	SyncManifest(const SyncManifest& other) = delete;
+	SyncManifest(SyncManifest&& other) noexcept = delete;
+	SyncManifest& operator=(const SyncManifest& other) = delete;
+	SyncManifest& operator=(SyncManifest&& other) noexcept = delete;
+
+	bool load(const std::string& path);
+	bool save() const;
+
+	bool isChanged(const std::string& path, const uint64_t size, const int64_t modified) const;
+	void update(const std::string& path, const uint64_t size, const int64_t modified);
+	size_t size() const { return _files.size(); }
+
+private:
+	struct State
+	{
+		uint64_t size = 0;
+		int64_t  modified = 0;
+	};
+
+	std::string                            _path;
+	std::unordered_map<std::string, State> _files;
+};
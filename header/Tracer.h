@@ -0,0 +1,80 @@
+/**
+ * Encrypted File Transfer Client
+ * @file Tracer.h
+ * @brief Low overhead event tracing of the client pipeline, exported in Chrome trace JSON format.
+ * Each thread writes begin/end events into its own ring buffer. Oldest events are overwritten once a ring is full.
+ * Open the exported file with chrome://tracing or https://ui.perfetto.dev.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Tracer
+{
+public:
+	static constexpr size_t RING_EVENTS = 16384;  // per thread.
+
+	struct Event
+	{
+		const char* name;
+		const char* category;
+		uint64_t    timestamp;  // nanoseconds since tracer creation.
+		char        phase;      // 'B' - begin, 'E' - end.
+	};
+
+	// Records a begin event on construction and an end event on destruction.
+	class Scope
+	{
+	public:
+		Scope(const char* name, const char* category);
+		virtual ~Scope();
+		Scope(const Scope& other) = delete;
+		Scope& operator=(const Scope& other) = delete;
+
+	private:
+		const char* _name;
+		const char* _category;
+		bool        _active;
+	};
+
+	static Tracer& instance();
+
+	virtual ~Tracer();
+	Tracer(const Tracer& other) = delete;
+	Tracer(Tracer&& other) noexcept = delete;
+	Tracer& operator=(const Tracer& other) = delete;
+	Tracer& operator=(Tracer&& other) noexcept = delete;
+
+	void enable(const bool enabled) { _enabled.store(enabled, std::memory_order_relaxed); }
+	bool isEnabled() const { return _enabled.load(std::memory_order_relaxed); }
+	void setOutput(const std::string& path);
+	bool exportChromeTrace(const std::string& path) const;
+
+private:
+	struct ThreadBuffer
+	{
+		uint32_t                        tid = 0;
+		std::atomic<uint64_t>           head{ 0 };   // total events written. Only the owning thread writes.
+		std::array<Event, RING_EVENTS>  events{};
+	};
+
+	Tracer();
+	void add(const char* name, const char* category, const char phase);
+	ThreadBuffer* threadBuffer();
+
+	static thread_local ThreadBuffer* _threadBuffer;
+
+	std::atomic<bool>                          _enabled;
+	const std::chrono::steady_clock::time_point _epoch;
+	mutable std::mutex                         _mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> _buffers;
+	std::string                                _outputPath;
+};
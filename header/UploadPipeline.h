@@ -0,0 +1,68 @@
+/**
+ * Encrypted File Transfer Client
+ * @file UploadPipeline.h
+ * @brief Staged upload of a file: reader -> CRC & encryption -> sender, each stage on its own thread.
+ * Stages pass chunks through bounded SpscRings, so disk, CPU and network work at the same time. Chunk buffers are
+ * taken from BufferPool once per upload and cycled back through free rings, so a full ring blocks its producer
+ * (backpressure) and memory stays bounded. Each consumer samples its ring's occupancy into Metrics, which tells the
+ * bottleneck stage.
+ * With io_uring enabled and supported, the reader submits batched reads and the sender batched linked writes
+ * into & from registered chunk buffers. Otherwise they use FileHandler and SocketHandler.
+ * A pipeline keeps its chunk buffers & rings across uploads, so buffers are registered once. One upload at a time.
+ * @author Arthur Rennert
+ */
+
+#pragma once
+#include "protocol.h"
+#include "BufferPool.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class SocketHandler;
+class IoUring;
+
+class UploadPipeline
+{
+public:
+	enum class EResult
+	{
+		RESULT_OK = 0,
+		RESULT_READ_FAILED,    // file could not be read in full.
+		RESULT_SEND_FAILED,
+		RESULT_START_FAILED    // a stage's thread could not be started.
+	};
+
+	static constexpr size_t DEFAULT_CHUNK_SIZE = static_cast<size_t>(1) << 20;
+	static constexpr size_t MIN_CHUNK_SIZE = static_cast<size_t>(64) << 10;
+	static constexpr size_t DEFAULT_QUEUE_DEPTH = 4;
+
+	UploadPipeline(const size_t chunkSize, const size_t queueDepth, const bool ioUring = false);
+	virtual ~UploadPipeline();
+	UploadPipeline(const UploadPipeline& other) = delete;
+	UploadPipeline(UploadPipeline&& other) noexcept = delete;
+	UploadPipeline& operator=(const UploadPipeline& other) = delete;
+	UploadPipeline& operator=(UploadPipeline&& other) noexcept = delete;
+
+	EResult send(SocketHandler& socket, const std::string& filePath, const size_t fileSize, const AESKey& key,
+		const uint8_t* const header, const size_t headerSize, uint32_t& crc);
+
+private:
+	struct Stages;
+
+	void read(Stages& stages) const;
+	void readUring(Stages& stages, IoUring& ring) const;
+	void encrypt(Stages& stages, const AESKey& key, uint32_t& crc) const;
+	bool sendSocket(Stages& stages, SocketHandler& socket) const;
+	bool sendUring(Stages& stages, SocketHandler& socket, IoUring& ring) const;
+
+	size_t _chunkSize;    // plain text bytes per chunk. A multiple of FileHandler::DIRECT_ALIGNMENT (& the AES block size).
+	size_t _queueDepth;
+	std::vector<BufferPool::Buffer> _plainBuffers;    // chunk slots, kept so that their registrations stay valid.
+	std::vector<BufferPool::Buffer> _cipherBuffers;
+	std::unique_ptr<IoUring>        _readRing;        // a ring per I/O thread. Null without io_uring.
+	std::unique_ptr<IoUring>        _sendRing;
+	bool                            _readRegistered;  // _plainBuffers are registered with _readRing.
+	bool                            _sendRegistered;  // _cipherBuffers are registered with _sendRing.
+};
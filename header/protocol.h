@@ -7,6 +7,8 @@
  */
 
 #pragma once
+#include <array>
+#include <cstddef>
 #include <cstdint>
 
 enum { DEFAULT_VALUE = 0 };  // Default value used to initialize protocol structures.
@@ -15,6 +17,7 @@ enum { DEFAULT_VALUE = 0 };  // Default value used to initialize protocol struct
 typedef uint8_t version_t;
 typedef uint16_t code_t;
 typedef uint32_t csize_t;  // protocol's size type: Content's, payload's and message's size.
+typedef uint32_t stream_t; // multiplexed session's stream id.
 
 // Constants. All sizes are in BYTES.
 constexpr version_t CLIENT_VERSION = 3;
@@ -25,9 +28,29 @@ constexpr size_t    FILE_NAME_SIZE = 255;
 constexpr size_t    PUBLIC_KEY_SIZE = 160;  // defined in protocol. 1024 bits.
 constexpr size_t    AES_KEY_SIZE = 16;   // defined in protocol.  128 bits.
 constexpr size_t    ENCRYPTED_AES_KEY_SIZE = 128; 
-constexpr size_t    REQUEST_OPTIONS = 6;
-constexpr size_t    RESPONSE_OPTIONS = 6;
+constexpr size_t    REQUEST_OPTIONS = 10;
+constexpr size_t    RESPONSE_OPTIONS = 8;
 constexpr size_t    MAX_FILE_RESEND_RETRIES = 3;
+constexpr size_t    MAX_PACKED_FILES = 1024;   // files per packed container, as its response flags mismatched ones in a bitmap.
+
+// Multiplexed session (version 4). Requests & responses above are carried unchanged, chunked into frames of a stream.
+// The connection is upgraded by a classic RequestUpgradeMultiplexed first. Frames follow once the server accepted it.
+constexpr version_t MULTIPLEXED_VERSION = 4;
+constexpr size_t    FRAME_PAYLOAD_SIZE = 16384;        // max data bytes per frame.
+constexpr csize_t   INITIAL_STREAM_WINDOW = 262144;    // bytes a stream may send before the server grants more.
+constexpr size_t    MAX_RESPONSE_SIZE = 65536;         // bound of a reassembled response.
+
+enum FrameType
+{
+	FRAME_DATA = 0,            // chunk of the stream's request / response.
+	FRAME_WINDOW_UPDATE = 1,   // payload: csize_t window increment of the stream.
+	FRAME_RESET = 2            // stream aborted. No payload.
+};
+
+enum FrameFlag
+{
+	FRAME_END_STREAM = 0x1     // last DATA frame of the stream's request / response.
+};
 
 enum RequestCode
 {
@@ -36,9 +59,20 @@ enum RequestCode
 	REQUEST_SEND_FILE = 1103,
 	REQUEST_SEND_VALID_CRC = 1104,
 	REQUEST_INVALID_CRC = 1005,
-	REQUEST_INVALID_CRC_FOURTH_TIME = 1106
+	REQUEST_INVALID_CRC_FOURTH_TIME = 1106,
+	REQUEST_SEND_FILE_STRIPE = 1107,       // range of a file's content. Stripes may arrive on parallel connections.
+	REQUEST_COMMIT_STRIPED_FILE = 1108,    // all stripes sent. Server reassembles, decrypts & replies with CRC.
+	REQUEST_SEND_PACKED_FILES = 1109,      // small files in a single encrypted container. Server verifies their CRCs.
+	REQUEST_UPGRADE_MULTIPLEXED = 1110     // switch the connection to frames of a multiplexed session.
 };
 
+constexpr RequestCode REQUEST_CODES[REQUEST_OPTIONS] = { REQUEST_REGISTRATION, REQUEST_SEND_PUBLIC_KEY, REQUEST_SEND_FILE,
+	REQUEST_SEND_VALID_CRC, REQUEST_INVALID_CRC, REQUEST_INVALID_CRC_FOURTH_TIME, REQUEST_SEND_FILE_STRIPE, REQUEST_COMMIT_STRIPED_FILE,
+	REQUEST_SEND_PACKED_FILES, REQUEST_UPGRADE_MULTIPLEXED };
+
+// Requests the server may receive twice with the same outcome, so they may be resent if the response never arrived.
+constexpr bool isIdempotent(const code_t code) { return code == REQUEST_SEND_FILE || code == REQUEST_SEND_FILE_STRIPE; }
+
 enum ResponseCode
 {
 	RESPONSE_REGISTRATION_SUCCESS = 2100,
@@ -46,6 +80,8 @@ enum ResponseCode
 	RESPONSE_ENCRYPTED_AES_KEY = 2102,
 	RESPONSE_SUCCESS_FILE_WITH_CRC = 2103,
 	RESPONSE_MSG_RECEIVED_THANKS = 2104,
+	RESPONSE_PACKED_FILES_RECEIVED = 2105,   // acknowledges all files of a packed container at once.
+	RESPONSE_MULTIPLEXED_ACCEPTED = 2106,    // frames follow on the connection.
 	RESPONSE_ERROR = 9999
 };
 
@@ -169,6 +205,75 @@ struct RequestSendFile
 	RequestSendFile(const ClientID& id) : header(id, REQUEST_SEND_FILE) {}
 };
 
+struct RequestSendFileStripe
+{
+	RequestHeader header;
+	struct PayloadHeader
+	{
+		csize_t     contentSize;   // whole file's content size.
+		File		file;
+		csize_t     offset;        // stripe's offset within the content.
+		csize_t     stripeSize;
+		PayloadHeader() : contentSize(DEFAULT_VALUE), offset(DEFAULT_VALUE), stripeSize(DEFAULT_VALUE) {}
+	}PayloadHeader;
+
+	RequestSendFileStripe(const ClientID& id) : header(id, REQUEST_SEND_FILE_STRIPE) {}
+};
+
+struct RequestCommitStripedFile
+{
+	RequestHeader header;
+	struct PayloadHeader
+	{
+		csize_t     contentSize;
+		csize_t     stripes;
+		File		file;
+		PayloadHeader() : contentSize(DEFAULT_VALUE), stripes(DEFAULT_VALUE) {}
+	}PayloadHeader;
+
+	RequestCommitStripedFile(const ClientID& id) : header(id, REQUEST_COMMIT_STRIPED_FILE) {}
+};
+
+// Index entry of a packed container. Followed by nameSize bytes of file name (not null terminated).
+struct PackedFileEntry
+{
+	csize_t  offset;     // of the file's data within the container.
+	csize_t  size;       // plain bytes.
+	csize_t  crc;        // of the plain file.
+	uint16_t nameSize;
+	PackedFileEntry() : offset(DEFAULT_VALUE), size(DEFAULT_VALUE), crc(DEFAULT_VALUE), nameSize(DEFAULT_VALUE) {}
+};
+
+// Content is the encrypted container: the files' data, then the index (a PackedFileEntry & name per file).
+struct RequestSendPackedFiles
+{
+	RequestHeader header;
+	struct PayloadHeader
+	{
+		csize_t     contentSize;
+		csize_t     files;
+		csize_t     indexSize;     // plain bytes of the index, which ends the container.
+		PayloadHeader() : contentSize(DEFAULT_VALUE), files(DEFAULT_VALUE), indexSize(DEFAULT_VALUE) {}
+	}PayloadHeader;
+
+	RequestSendPackedFiles(const ClientID& id) : header(id, REQUEST_SEND_PACKED_FILES) {}
+};
+
+// Server stored the files whose CRC matched the index. All of them if validated == files.
+// The others are flagged in mismatched, so only they are sent again.
+struct ResponsePackedFilesReceived
+{
+	ResponseHeader header;
+	struct PayloadHeader
+	{
+		ClientID       clientId;
+		csize_t        files;
+		csize_t        validated;
+		uint8_t        mismatched[MAX_PACKED_FILES / 8];   // bit i % 8 of byte i / 8 is set if the i-th indexed file mismatched.
+		PayloadHeader() : files(DEFAULT_VALUE), validated(DEFAULT_VALUE), mismatched{} {}
+	}PayloadHeader;
+};
+
 struct ResponseFileAcception
 {
 	ResponseHeader header;
@@ -207,4 +312,179 @@ struct RequestInvalidCRCAbort
 	RequestInvalidCRCAbort(const ClientID& id) : header(id, REQUEST_INVALID_CRC_FOURTH_TIME) {}
 };
 
-#pragma pack(pop)
\ No newline at end of file
+struct RequestUpgradeMultiplexed
+{
+	RequestHeader header;
+	RequestUpgradeMultiplexed(const ClientID& id) : header(id, REQUEST_UPGRADE_MULTIPLEXED) {}
+};
+
+struct ResponseMultiplexedAccepted
+{
+	ResponseHeader header;
+	ClientID       clientId;
+};
+
+struct FrameHeader
+{
+	version_t version;
+	uint8_t   type;
+	uint8_t   flags;
+	stream_t  streamId;   // odd ids are opened by the client. 0 is reserved.
+	csize_t   length;     // frame payload size.
+	FrameHeader() : version(MULTIPLEXED_VERSION), type(FRAME_DATA), flags(DEFAULT_VALUE), streamId(DEFAULT_VALUE), length(DEFAULT_VALUE) {}
+};
+
+#pragma pack(pop)
+
+/**
+ * Compile time protocol descriptors.
+ * Each message struct is mapped to its code & fixed payload size. Each request is also mapped to its expected Response
+ * (void if the server does not reply) and optionally to a Failure response.
+ * Adding a message type only requires a specialization below. Unknown types fail to compile.
+ */
+template <typename Message>
+struct MessageDescriptor;
+
+template <typename Message, code_t Code>
+struct ResponseDescriptor
+{
+	static constexpr code_t  code = Code;
+	static constexpr csize_t payloadSize = static_cast<csize_t>(sizeof(Message) - sizeof(ResponseHeader));
+};
+
+template <typename Message, code_t Code, typename ExpectedResponse, bool VariablePayload = false>
+struct RequestDescriptor
+{
+	using Response = ExpectedResponse;
+	static constexpr code_t  code = Code;
+	static constexpr csize_t payloadSize = static_cast<csize_t>(sizeof(Message) - sizeof(RequestHeader));  // fixed part.
+	static constexpr bool    variablePayload = VariablePayload;  // payload continues after the struct.
+};
+
+template <> struct MessageDescriptor<ResponseRegistrationSucceed> : ResponseDescriptor<ResponseRegistrationSucceed, RESPONSE_REGISTRATION_SUCCESS> {};
+template <> struct MessageDescriptor<ResponseRegistrationFailed>  : ResponseDescriptor<ResponseRegistrationFailed, RESPONSE_REGISTRATION_FAILED> {};
+template <> struct MessageDescriptor<ResponseEncryptedKey>        : ResponseDescriptor<ResponseEncryptedKey, RESPONSE_ENCRYPTED_AES_KEY> {};
+template <> struct MessageDescriptor<ResponseFileAcception>       : ResponseDescriptor<ResponseFileAcception, RESPONSE_SUCCESS_FILE_WITH_CRC> {};
+template <> struct MessageDescriptor<ResponseMSGReceived>         : ResponseDescriptor<ResponseMSGReceived, RESPONSE_MSG_RECEIVED_THANKS> {};
+template <> struct MessageDescriptor<ResponsePackedFilesReceived> : ResponseDescriptor<ResponsePackedFilesReceived, RESPONSE_PACKED_FILES_RECEIVED> {};
+template <> struct MessageDescriptor<ResponseMultiplexedAccepted> : ResponseDescriptor<ResponseMultiplexedAccepted, RESPONSE_MULTIPLEXED_ACCEPTED> {};
+
+template <> struct MessageDescriptor<RequestRegistration> : RequestDescriptor<RequestRegistration, REQUEST_REGISTRATION, ResponseRegistrationSucceed>
+{
+	using Failure = ResponseRegistrationFailed;
+	static constexpr auto name = "Registration";
+};
+template <> struct MessageDescriptor<RequestSendPublicKey>   : RequestDescriptor<RequestSendPublicKey, REQUEST_SEND_PUBLIC_KEY, ResponseEncryptedKey> {};
+template <> struct MessageDescriptor<RequestSendFile>        : RequestDescriptor<RequestSendFile, REQUEST_SEND_FILE, ResponseFileAcception, true> {};
+template <> struct MessageDescriptor<RequestSendFileStripe>  : RequestDescriptor<RequestSendFileStripe, REQUEST_SEND_FILE_STRIPE, ResponseMSGReceived, true> {};
+template <> struct MessageDescriptor<RequestCommitStripedFile> : RequestDescriptor<RequestCommitStripedFile, REQUEST_COMMIT_STRIPED_FILE, ResponseFileAcception> {};
+template <> struct MessageDescriptor<RequestSendPackedFiles> : RequestDescriptor<RequestSendPackedFiles, REQUEST_SEND_PACKED_FILES, ResponsePackedFilesReceived, true> {};
+template <> struct MessageDescriptor<RequestValidCRC>        : RequestDescriptor<RequestValidCRC, REQUEST_SEND_VALID_CRC, ResponseMSGReceived> {};
+template <> struct MessageDescriptor<RequestInvalidCRC>      : RequestDescriptor<RequestInvalidCRC, REQUEST_INVALID_CRC, void> {};
+template <> struct MessageDescriptor<RequestInvalidCRCAbort> : RequestDescriptor<RequestInvalidCRCAbort, REQUEST_INVALID_CRC_FOURTH_TIME, ResponseMSGReceived> {};
+template <> struct MessageDescriptor<RequestUpgradeMultiplexed> : RequestDescriptor<RequestUpgradeMultiplexed, REQUEST_UPGRADE_MULTIPLEXED, ResponseMultiplexedAccepted> {};
+
+/**
+ * Wire layout of multi-byte integer fields. Protocol is little endian; other fields are byte arrays.
+ * Used by Serializer to convert only these fields on big endian hosts.
+ */
+struct WireField
+{
+	size_t offset;
+	size_t size;
+};
+
+template <typename Message>
+struct WireLayout
+{
+	static constexpr std::array<WireField, 2> fields{ {
+		{ offsetof(Message, header) + offsetof(decltype(Message::header), code), sizeof(code_t) },
+		{ offsetof(Message, header) + offsetof(decltype(Message::header), payloadSize), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<ResponseHeader>
+{
+	static constexpr std::array<WireField, 2> fields{ {
+		{ offsetof(ResponseHeader, code), sizeof(code_t) },
+		{ offsetof(ResponseHeader, payloadSize), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<RequestSendFile>
+{
+	static constexpr std::array<WireField, 3> fields{ {
+		{ offsetof(RequestSendFile, header) + offsetof(RequestHeader, code), sizeof(code_t) },
+		{ offsetof(RequestSendFile, header) + offsetof(RequestHeader, payloadSize), sizeof(csize_t) },
+		{ offsetof(RequestSendFile, PayloadHeader) + offsetof(decltype(RequestSendFile::PayloadHeader), contentSize), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<RequestSendFileStripe>
+{
+	static constexpr std::array<WireField, 5> fields{ {
+		{ offsetof(RequestSendFileStripe, header) + offsetof(RequestHeader, code), sizeof(code_t) },
+		{ offsetof(RequestSendFileStripe, header) + offsetof(RequestHeader, payloadSize), sizeof(csize_t) },
+		{ offsetof(RequestSendFileStripe, PayloadHeader) + offsetof(decltype(RequestSendFileStripe::PayloadHeader), contentSize), sizeof(csize_t) },
+		{ offsetof(RequestSendFileStripe, PayloadHeader) + offsetof(decltype(RequestSendFileStripe::PayloadHeader), offset), sizeof(csize_t) },
+		{ offsetof(RequestSendFileStripe, PayloadHeader) + offsetof(decltype(RequestSendFileStripe::PayloadHeader), stripeSize), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<RequestCommitStripedFile>
+{
+	static constexpr std::array<WireField, 4> fields{ {
+		{ offsetof(RequestCommitStripedFile, header) + offsetof(RequestHeader, code), sizeof(code_t) },
+		{ offsetof(RequestCommitStripedFile, header) + offsetof(RequestHeader, payloadSize), sizeof(csize_t) },
+		{ offsetof(RequestCommitStripedFile, PayloadHeader) + offsetof(decltype(RequestCommitStripedFile::PayloadHeader), contentSize), sizeof(csize_t) },
+		{ offsetof(RequestCommitStripedFile, PayloadHeader) + offsetof(decltype(RequestCommitStripedFile::PayloadHeader), stripes), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<PackedFileEntry>
+{
+	static constexpr std::array<WireField, 4> fields{ {
+		{ offsetof(PackedFileEntry, offset), sizeof(csize_t) },
+		{ offsetof(PackedFileEntry, size), sizeof(csize_t) },
+		{ offsetof(PackedFileEntry, crc), sizeof(csize_t) },
+		{ offsetof(PackedFileEntry, nameSize), sizeof(uint16_t) } } };
+};
+
+template <>
+struct WireLayout<RequestSendPackedFiles>
+{
+	static constexpr std::array<WireField, 5> fields{ {
+		{ offsetof(RequestSendPackedFiles, header) + offsetof(RequestHeader, code), sizeof(code_t) },
+		{ offsetof(RequestSendPackedFiles, header) + offsetof(RequestHeader, payloadSize), sizeof(csize_t) },
+		{ offsetof(RequestSendPackedFiles, PayloadHeader) + offsetof(decltype(RequestSendPackedFiles::PayloadHeader), contentSize), sizeof(csize_t) },
+		{ offsetof(RequestSendPackedFiles, PayloadHeader) + offsetof(decltype(RequestSendPackedFiles::PayloadHeader), files), sizeof(csize_t) },
+		{ offsetof(RequestSendPackedFiles, PayloadHeader) + offsetof(decltype(RequestSendPackedFiles::PayloadHeader), indexSize), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<ResponsePackedFilesReceived>
+{
+	static constexpr std::array<WireField, 4> fields{ {
+		{ offsetof(ResponsePackedFilesReceived, header) + offsetof(ResponseHeader, code), sizeof(code_t) },
+		{ offsetof(ResponsePackedFilesReceived, header) + offsetof(ResponseHeader, payloadSize), sizeof(csize_t) },
+		{ offsetof(ResponsePackedFilesReceived, PayloadHeader) + offsetof(decltype(ResponsePackedFilesReceived::PayloadHeader), files), sizeof(csize_t) },
+		{ offsetof(ResponsePackedFilesReceived, PayloadHeader) + offsetof(decltype(ResponsePackedFilesReceived::PayloadHeader), validated), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<ResponseFileAcception>
+{
+	static constexpr std::array<WireField, 4> fields{ {
+		{ offsetof(ResponseFileAcception, header) + offsetof(ResponseHeader, code), sizeof(code_t) },
+		{ offsetof(ResponseFileAcception, header) + offsetof(ResponseHeader, payloadSize), sizeof(csize_t) },
+		{ offsetof(ResponseFileAcception, PayloadHeader) + offsetof(decltype(ResponseFileAcception::PayloadHeader), contentSize), sizeof(csize_t) },
+		{ offsetof(ResponseFileAcception, PayloadHeader) + offsetof(decltype(ResponseFileAcception::PayloadHeader), crc), sizeof(csize_t) } } };
+};
+
+template <>
+struct WireLayout<FrameHeader>
+{
+	static constexpr std::array<WireField, 2> fields{ {
+		{ offsetof(FrameHeader, streamId), sizeof(stream_t) },
+		{ offsetof(FrameHeader, length), sizeof(csize_t) } } };
+};
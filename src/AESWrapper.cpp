@@ -7,6 +7,7 @@
 
 #include "pch.h"
 #include "AESWrapper.h"
+#include "Tracer.h"
 #include <modes.h>
 #include <aes.h>
 #include <filters.h>
@@ -31,6 +32,7 @@ AESWrapper::AESWrapper(const AESKey& symKey) : _key(symKey)
 
 std::string AESWrapper::encrypt(const uint8_t* plain, size_t length) const
 {
+	Tracer::Scope trace("AESWrapper::encrypt", "crypto");
 	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };	// for practical use iv should never be a fixed value!
 
 	CryptoPP::AES::Encryption aesEncryption(_key.symmetricKey, sizeof(_key.symmetricKey));
@@ -44,3 +46,75 @@ std::string AESWrapper::encrypt(const uint8_t* plain, size_t length) const
 	return cipher;
 }
 
+/**
+ * Encrypt into a pooled buffer of cipherSize(length) bytes.
+ */
+void AESWrapper::encrypt(const uint8_t* plain, size_t length, BufferPool::Buffer& cipher) const
+{
+	cipher = BufferPool::instance().acquire(cipherSize(length));
+	(void)encrypt(std::span<const uint8_t>(plain, length), std::span<uint8_t>(cipher.data(), cipher.size()));
+}
+
+/**
+ * Encrypt plain straight into a caller provided buffer, which must hold at least cipherSize(plain.size()) bytes.
+ * PKCS #7 padding (StreamTransformationFilter's default for CBC) is applied here, so no intermediate string is built.
+ * Return bytes written. 0 if cipher is too small.
+ */
+size_t AESWrapper::encrypt(std::span<const uint8_t> plain, std::span<uint8_t> cipher) const
+{
+	Tracer::Scope trace("AESWrapper::encrypt", "crypto");
+	Encryptor encryptor(_key);
+	return encryptor.finish(plain, cipher);
+}
+
+struct AESWrapper::Encryptor::Impl
+{
+	explicit Impl(const AESKey& key) : aes(key.symmetricKey, sizeof(key.symmetricKey)), cbc(aes, iv) {}
+
+	CryptoPP::byte                                iv[BLOCK_SIZE] = { 0 };	// for practical use iv should never be a fixed value!
+	CryptoPP::AES::Encryption                     aes;
+	CryptoPP::CBC_Mode_ExternalCipher::Encryption cbc;
+};
+
+AESWrapper::Encryptor::Encryptor(const AESKey& key) : _impl(std::make_unique<Impl>(key))
+{
+	static_assert(BLOCK_SIZE == CryptoPP::AES::BLOCKSIZE, "AES block size mismatch");
+}
+
+AESWrapper::Encryptor::~Encryptor() = default;
+
+/**
+ * Encrypt a part of the message. plain.size() must be a multiple of BLOCK_SIZE and cipher at least as large.
+ * Return bytes written. 0 if the sizes do not fit.
+ */
+size_t AESWrapper::Encryptor::update(std::span<const uint8_t> plain, std::span<uint8_t> cipher)
+{
+	if ((plain.size() % BLOCK_SIZE) != 0 || cipher.size() < plain.size())
+		return 0;
+	if (!plain.empty())
+		_impl->cbc.ProcessData(cipher.data(), plain.data(), plain.size());
+	return plain.size();
+}
+
+/**
+ * Encrypt the last part of the message, of any size, and add PKCS #7 padding.
+ * cipher must hold at least cipherSize(plain.size()) bytes. Return bytes written. 0 if cipher is too small.
+ */
+size_t AESWrapper::Encryptor::finish(std::span<const uint8_t> plain, std::span<uint8_t> cipher)
+{
+	const size_t cipherLength = cipherSize(plain.size());
+	if (cipher.size() < cipherLength)
+		return 0;
+
+	const size_t fullBlocks = plain.size() - (plain.size() % BLOCK_SIZE);
+	const size_t padding = BLOCK_SIZE - (plain.size() % BLOCK_SIZE);
+	if (fullBlocks > 0)
+		_impl->cbc.ProcessData(cipher.data(), plain.data(), fullBlocks);
+
+	CryptoPP::byte last[BLOCK_SIZE];
+	memcpy(last, plain.data() + fullBlocks, BLOCK_SIZE - padding);
+	memset(last + BLOCK_SIZE - padding, static_cast<int>(padding), padding);
+	_impl->cbc.ProcessData(cipher.data() + fullBlocks, last, BLOCK_SIZE);
+	return cipherLength;
+}
+
@@ -0,0 +1,222 @@
+/**
+ * Encrypted File Transfer Client
+ * @file BufferPool.cpp
+ * @brief Size-classed pool of reusable byte buffers for message construction & crypto output.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "BufferPool.h"
+#include <bit>
+#include <new>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>   // VirtualAlloc
+#else
+#include <sys/mman.h>  // mmap, madvise
+#endif
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept : _block(other._block), _size(other._size)
+{
+	other._block = Block();
+	other._size = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept
+{
+	if (this != &other)
+	{
+		release();
+		_block = other._block;
+		_size = other._size;
+		other._block = Block();
+		other._size = 0;
+	}
+	return *this;
+}
+
+/**
+ * Change the used size within the current capacity.
+ */
+bool BufferPool::Buffer::resize(const size_t size)
+{
+	if (size > _block.capacity)
+		return false;
+	_size = size;
+	return true;
+}
+
+/**
+ * Return the buffer to the pool. The handle is empty afterwards.
+ */
+void BufferPool::Buffer::release()
+{
+	if (_block.data != nullptr)
+		BufferPool::instance().release(_block);
+	_block = Block();
+	_size = 0;
+}
+
+BufferPool& BufferPool::instance()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+BufferPool::BufferPool() : _hugePages(false), _maxCachedBytes(DEFAULT_MAX_CACHED_BYTES), _cachedBytes(0),
+	_hits(0), _misses(0), _releases(0), _discards(0)
+{
+	for (auto& sizeClass : _classes)
+		sizeClass.free.reserve(8);  // avoid growing free lists during steady state.
+}
+
+BufferPool::~BufferPool()
+{
+	trim();
+}
+
+/**
+ * Return the class of the smallest power of two holding size. CLASSES if size is too large to be pooled.
+ */
+size_t BufferPool::classIndex(const size_t size)
+{
+	if (size <= (static_cast<size_t>(1) << MIN_CLASS_BITS))
+		return 0;
+	const size_t bits = static_cast<size_t>(std::bit_width(size - 1));
+	return (bits > MAX_CLASS_BITS) ? CLASSES : (bits - MIN_CLASS_BITS);
+}
+
+/**
+ * Acquire a buffer of at least size bytes. Throws std::bad_alloc if memory is exhausted.
+ */
+BufferPool::Buffer BufferPool::acquire(const size_t size)
+{
+	const size_t index = classIndex(size);
+	if (index == CLASSES)
+	{
+		_misses.fetch_add(1, std::memory_order_relaxed);
+		return Buffer(allocate(size), size);
+	}
+
+	auto& sizeClass = _classes[index];
+	{
+		std::lock_guard<std::mutex> lock(sizeClass.mutex);
+		if (!sizeClass.free.empty())
+		{
+			const Block block = sizeClass.free.back();
+			sizeClass.free.pop_back();
+			_cachedBytes.fetch_sub(block.capacity, std::memory_order_relaxed);
+			_hits.fetch_add(1, std::memory_order_relaxed);
+			return Buffer(block, size);
+		}
+	}
+	_misses.fetch_add(1, std::memory_order_relaxed);
+	return Buffer(allocate(static_cast<size_t>(1) << (index + MIN_CLASS_BITS)), size);
+}
+
+/**
+ * Cache a released block for reuse. Free it if it is not pooled or the cache is full.
+ */
+void BufferPool::release(const Block& block)
+{
+	_releases.fetch_add(1, std::memory_order_relaxed);
+	const size_t index = classIndex(block.capacity);
+	if (index < CLASSES && (static_cast<size_t>(1) << (index + MIN_CLASS_BITS)) == block.capacity)
+	{
+		const size_t cached = _cachedBytes.fetch_add(block.capacity, std::memory_order_relaxed) + block.capacity;
+		if (cached <= _maxCachedBytes.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				std::lock_guard<std::mutex> lock(_classes[index].mutex);
+				_classes[index].free.push_back(block);
+				return;
+			}
+			catch (...) {} // Free list couldn't grow. Free the block.
+		}
+		_cachedBytes.fetch_sub(block.capacity, std::memory_order_relaxed);
+	}
+	_discards.fetch_add(1, std::memory_order_relaxed);
+	deallocate(block);
+}
+
+/**
+ * Free all cached buffers.
+ */
+void BufferPool::trim()
+{
+	for (auto& sizeClass : _classes)
+	{
+		std::lock_guard<std::mutex> lock(sizeClass.mutex);
+		for (const auto& block : sizeClass.free)
+		{
+			_cachedBytes.fetch_sub(block.capacity, std::memory_order_relaxed);
+			deallocate(block);
+		}
+		sizeClass.free.clear();
+	}
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+	Stats stats;
+	stats.hits = _hits.load(std::memory_order_relaxed);
+	stats.misses = _misses.load(std::memory_order_relaxed);
+	stats.releases = _releases.load(std::memory_order_relaxed);
+	stats.discards = _discards.load(std::memory_order_relaxed);
+	stats.cachedBytes = _cachedBytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+/**
+ * Allocate capacity bytes. Large blocks are backed by huge pages if enabled and available.
+ */
+BufferPool::Block BufferPool::allocate(const size_t capacity) const
+{
+	Block block;
+	block.capacity = capacity;
+	if (_hugePages.load(std::memory_order_relaxed) && capacity >= HUGE_PAGE_SIZE)
+	{
+#ifdef _WIN32
+		// Large pages require SeLockMemoryPrivilege. Fallback to regular pages otherwise.
+		const size_t largePage = GetLargePageMinimum();
+		if (largePage != 0 && capacity % largePage == 0)
+			block.data = static_cast<uint8_t*>(VirtualAlloc(nullptr, capacity, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+		if (block.data == nullptr)
+			block.data = static_cast<uint8_t*>(VirtualAlloc(nullptr, capacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+		void* ptr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr != MAP_FAILED)
+		{
+#ifdef MADV_HUGEPAGE
+			(void)madvise(ptr, capacity, MADV_HUGEPAGE);  // transparent huge pages. Best effort.
+#endif
+			block.data = static_cast<uint8_t*>(ptr);
+		}
+#endif
+		if (block.data != nullptr)
+		{
+			block.mapped = true;
+			return block;
+		}
+	}
+	block.data = new (std::align_val_t(ALIGNMENT)) uint8_t[capacity];
+	return block;
+}
+
+void BufferPool::deallocate(const Block& block)
+{
+	if (block.data == nullptr)
+		return;
+	if (!block.mapped)
+	{
+		::operator delete[](block.data, std::align_val_t(ALIGNMENT));
+		return;
+	}
+#ifdef _WIN32
+	VirtualFree(block.data, 0, MEM_RELEASE);
+#else
+	munmap(block.data, block.capacity);
+#endif
+}
@@ -0,0 +1,72 @@
+/**
+ * Encrypted File Transfer Client
+ * @file CancellationToken.cpp
+ * @brief Cancellation & overall deadline shared by the socket operations of a transfer.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "CancellationToken.h"
+
+CancellationToken::DeadlineScope::DeadlineScope(CancellationToken& token, const std::chrono::milliseconds timeout) : _token(token)
+{
+	_token.reset((timeout.count() > 0) ? (std::chrono::steady_clock::now() + timeout) : std::chrono::steady_clock::time_point::max());
+}
+
+CancellationToken::DeadlineScope::~DeadlineScope()
+{
+	_token.reset(std::chrono::steady_clock::time_point::max());
+}
+
+CancellationToken::CancellationToken() : _cancelled(false), _deadline(std::chrono::steady_clock::time_point::max()), _nextId(0)
+{
+}
+
+/**
+ * Cancel & notify subscribers once. Callbacks run on the calling thread, so they must not block.
+ */
+void CancellationToken::cancel()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_cancelled.exchange(true, std::memory_order_acq_rel))
+		return;
+	for (const auto& [id, callback] : _callbacks)
+		callback();
+}
+
+/**
+ * Clear cancellation and set a new deadline. Not to be called while operations use the token.
+ */
+void CancellationToken::reset(const std::chrono::steady_clock::time_point& deadline)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_cancelled.store(false, std::memory_order_release);
+	_deadline = deadline;
+}
+
+std::chrono::steady_clock::time_point CancellationToken::deadline() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _deadline;
+}
+
+/**
+ * Call callback upon cancel(). Return an id for unsubscribe(). A cancelled token calls callback at once.
+ */
+size_t CancellationToken::subscribe(Callback callback)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_cancelled.load(std::memory_order_acquire))
+		callback();
+	_callbacks.emplace(++_nextId, std::move(callback));
+	return _nextId;
+}
+
+/**
+ * Once returned, callback is not running and will not be called.
+ */
+void CancellationToken::unsubscribe(const size_t id)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_callbacks.erase(id);
+}
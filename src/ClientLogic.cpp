@@ -13,12 +13,37 @@
 #include "AESWrapper.h"
 #include "FileHandler.h"
 #include "SocketHandler.h"
-
-
-ClientLogic::ClientLogic() : _fileHandler(nullptr), _socketHandler(nullptr), _rsaDecryptor(nullptr)
+#include "Metrics.h"
+#include "Tracer.h"
+#include "BufferPool.h"
+#include "Serializer.h"
+#include "MultiplexedSession.h"
+#include "RateLimiter.h"
+#include "EndpointResolver.h"
+#include "CancellationToken.h"
+#include "UploadPipeline.h"
+#include "SyncManifest.h"
+#include "FolderWatcher.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <boost/filesystem.hpp>
+
+
+ClientLogic::ClientLogic() : _pipelineDepth(1), _multiplexStreams(0), _stripeConnections(1), _speculativeConnect(false), _currentServer(0), _serverSelected(false),
+	_sessionServer(0), _sessionBound(false), _sessionMoves(0), _replicate(false), _stagedUpload(false),
+	_stagedChunkSize(UploadPipeline::DEFAULT_CHUNK_SIZE), _stagedQueueDepth(UploadPipeline::DEFAULT_QUEUE_DEPTH), _ioUring(false), _transferTimeout(0), _syncScanThreads(1), _syncOrder(DirectoryScanner::EOrder::ORDER_INODE),
+	_watchDebounce(FolderWatcher::DEFAULT_DEBOUNCE), _watchMaxDelay(FolderWatcher::DEFAULT_MAX_DELAY), _watchMaxBatch(FolderWatcher::DEFAULT_MAX_BATCH), _stopRequested(false),
+	_packSmallFiles(false), _packMaxFileSize(DEFAULT_PACK_MAX_FILE_SIZE), _packMaxBytes(DEFAULT_PACK_MAX_BYTES), _fileHandler(nullptr), _socketHandler(nullptr), _rsaDecryptor(nullptr)
 {
 	_fileHandler = new FileHandler();
 	_socketHandler = new SocketHandler();
+	_cancellation = std::make_shared<CancellationToken>();
+	_socketHandler->setCancellation(_cancellation);
 }
 
 ClientLogic::~ClientLogic()
@@ -59,6 +84,48 @@ bool ClientLogic::parseFileName(std::string& fileName)
 	return true;
 }
 
+/**
+ * Parse SERVER_INFO file for all file names. Each line starting from the third holds a file name.
+ */
+bool ClientLogic::parseFileNames(std::vector<std::string>& fileNames)
+{
+	if (!_fileHandler->open(SERVER_INFO))
+	{
+		clearLastError();
+		_lastError << "Couldn't open " << SERVER_INFO;
+		return false;
+	}
+
+	std::string info;
+	// Skip first 2 lines
+	for (int i = 0; i < 2; i++)
+	{
+		if (!_fileHandler->readLine(info))
+		{
+			clearLastError();
+			_lastError << "Couldn't read file name from: " << SERVER_INFO;
+			return false;
+		}
+	}
+
+	fileNames.clear();
+	while (_fileHandler->readLine(info))
+	{
+		Stringer::trim(info);
+		if (!info.empty())
+			fileNames.push_back(info);
+	}
+	_fileHandler->close();
+
+	if (fileNames.empty())
+	{
+		clearLastError();
+		_lastError << "Couldn't read file name from: " << SERVER_INFO;
+		return false;
+	}
+	return true;
+}
+
 /**
  * Parse SERVER_INFO file for server address & port.
  */
@@ -78,22 +145,57 @@ bool ClientLogic::parseServeInfo()
 		return false;
 	}
 	_fileHandler->close();
-	Stringer::trim(info);
-	const auto pos = info.find(':');
-	if (pos == std::string::npos)
+
+	// A comma separated list of servers is balanced & failed over.
+	_servers.clear();
+	std::stringstream servers(info);
+	std::string server;
+	while (std::getline(servers, server, ','))
 	{
-		clearLastError();
-		_lastError << SERVER_INFO << " has invalid format! missing separator ':'";
-		return false;
+		Stringer::trim(server);
+		const auto pos = server.find(':');
+		if (pos == std::string::npos)
+		{
+			clearLastError();
+			_lastError << SERVER_INFO << " has invalid format! missing separator ':'";
+			return false;
+		}
+		const auto address = server.substr(0, pos);
+		const auto port = server.substr(pos + 1);
+		if (!_socketHandler->setSocketInfo(address, port))
+		{
+			clearLastError();
+			_lastError << SERVER_INFO << " has invalid IP address or port!";
+			return false;
+		}
+		_servers.add(address, port);
 	}
-	const auto address = info.substr(0, pos);
-	const auto port = info.substr(pos + 1);
-	if (!_socketHandler->setSocketInfo(address, port))
+	_currentServer = _servers.size() - 1;  // _socketHandler points to the last one parsed.
+	loadSession();
+	return true;
+}
+
+/**
+ * Parse optional OPTIONS_INFO file and apply its settings. A missing file keeps the defaults.
+ */
+bool ClientLogic::parseOptionsInfo()
+{
+	if (!_fileHandler->open(OPTIONS_INFO))
+		return true;  // optional file.
+
+	std::string line;
+	while (_fileHandler->readLine(line))
 	{
-		clearLastError();
-		_lastError << SERVER_INFO << " has invalid IP address or port!";
-		return false;
+		if (!_options.parseLine(line))
+		{
+			_fileHandler->close();
+			clearLastError();
+			_lastError << OPTIONS_INFO << " has invalid line: " << line;
+			return false;
+		}
 	}
+	_fileHandler->close();
+	applyOptions();
 	return true;
 }
 
@@ -251,6 +353,365 @@ void ClientLogic::clearLastError()
 	_lastError.copyfmt(clean);
 }
 
+/**
+ * Set _lastError of a failed socket operation on _socketHandler.
+ */
+void ClientLogic::setCommunicationError()
+{
+	clearLastError();
+	_lastError << "Failed communicating with server on " << _socketHandler;
+	if (_cancellation->isCancelled())
+		_lastError << " (transfer cancelled or timed out)";
+}
+
+/**
+ * Abort the transfer in progress, including blocked socket operations, and stop watching a directory.
+ * May be called from any thread.
+ */
+void ClientLogic::cancel()
+{
+	_stopRequested.store(true);
+	_cancellation->cancel();
+	std::lock_guard<std::mutex> lock(_watcherMutex);
+	if (_watcher)
+		_watcher->stop();
+}
+
+/**
+ * Configure internal modules according to parsed options.
+ */
+void ClientLogic::applyOptions()
+{
+	auto& metrics = Metrics::instance();
+	metrics.setJsonOutput(_options.getString("metrics_json"));
+	metrics.setPrometheusOutput(_options.getString("metrics_prometheus"));
+	metrics.enable(_options.getBool("metrics", _options.contains("metrics_json") || _options.contains("metrics_prometheus")));
+	metrics.setLatencyOutput(_options.getString("latency_histograms"));
+
+	auto& tracer = Tracer::instance();
+	tracer.setOutput(_options.getString("trace"));
+	tracer.enable(_options.contains("trace"));
+
+	_pipelineDepth = static_cast<size_t>(_options.getUInt("pipeline_depth", 1));
+	if (_pipelineDepth == 0)
+		_pipelineDepth = 1;
+	_multiplexStreams = static_cast<size_t>(_options.getUInt("multiplex_streams", 0));
+	_stripeConnections = (_options.getString("stripe_connections") == "auto") ? 0 :
+		std::min(static_cast<size_t>(_options.getUInt("stripe_connections", 1)), MAX_STRIPES);
+	_concurrency.enable(_options.getBool("adaptive_concurrency"));
+	_speculativeConnect = _options.getBool("speculative_connect");
+	_replicate = _options.getBool("replicate");
+	_stagedUpload = _options.getBool("staged_upload");
+	_stagedChunkSize = static_cast<size_t>(_options.getUInt("staged_chunk_size", UploadPipeline::DEFAULT_CHUNK_SIZE));
+	_stagedQueueDepth = static_cast<size_t>(_options.getUInt("staged_queue_depth", UploadPipeline::DEFAULT_QUEUE_DEPTH));
+	_ioUring = _options.getBool("io_uring");
+	_uploadPipeline.reset();  // built again with the above upon the next staged upload.
+
+	_syncDirectory = _options.getString("sync_directory");
+	_syncScanThreads = static_cast<size_t>(_options.getUInt("sync_scan_threads", std::max(std::thread::hardware_concurrency(), 1U)));
+	DirectoryScanner::EOrder order;
+	if (DirectoryScanner::parseOrder(_options.getString("sync_order", "inode"), order))
+		_syncOrder = order;
+	_watchDirectory = _options.getString("watch_directory");
+	_watchDebounce = std::chrono::milliseconds(_options.getUInt("watch_debounce_ms", FolderWatcher::DEFAULT_DEBOUNCE.count()));
+	_watchMaxDelay = std::chrono::milliseconds(_options.getUInt("watch_max_delay_ms", FolderWatcher::DEFAULT_MAX_DELAY.count()));
+	_watchMaxBatch = static_cast<size_t>(_options.getUInt("watch_max_batch", FolderWatcher::DEFAULT_MAX_BATCH));
+	_packSmallFiles = _options.getBool("pack_small_files");
+	_packMaxFileSize = static_cast<size_t>(_options.getUInt("pack_max_file_size", DEFAULT_PACK_MAX_FILE_SIZE));
+	_packMaxBytes = std::min(static_cast<size_t>(_options.getUInt("pack_max_bytes", DEFAULT_PACK_MAX_BYTES)), MAX_PACK_BYTES);
+
+	FileHandler::ECacheMode cacheMode;
+	if (FileHandler::parseCacheMode(_options.getString("read_cache", "default"), cacheMode))
+		FileHandler::setCacheMode(cacheMode);
+
+	ServerPool::EStrategy strategy;
+	if (ServerPool::parseStrategy(_options.getString("server_strategy", "round_robin"), strategy))
+		_servers.setStrategy(strategy);
+
+	SocketHandler::Tuning tuning;
+	tuning.noDelay = _options.getBool("tcp_nodelay", true);
+	tuning.cork = _options.getBool("tcp_cork");
+	tuning.autoBuffers = (_options.getString("socket_buffers") == "auto");
+	tuning.sendBuffer = tuning.receiveBuffer = static_cast<size_t>(_options.getUInt("socket_buffers"));
+	tuning.fastOpen = _options.getBool("tcp_fast_open");
+	SocketHandler::setTuning(tuning);
+	SocketHandler::Timeouts timeouts;
+	timeouts.connect = std::chrono::milliseconds(_options.getUInt("connect_timeout_ms"));
+	timeouts.send = std::chrono::milliseconds(_options.getUInt("send_timeout_ms"));
+	timeouts.receive = std::chrono::milliseconds(_options.getUInt("receive_timeout_ms"));
+	SocketHandler::setTimeouts(timeouts);
+	_transferTimeout = std::chrono::milliseconds(_options.getUInt("transfer_timeout_ms"));
+	EndpointResolver::instance().setTTL(std::chrono::seconds(_options.getUInt("resolver_ttl", EndpointResolver::DEFAULT_TTL.count())),
+		std::chrono::seconds(_options.getUInt("resolver_negative_ttl", EndpointResolver::DEFAULT_NEGATIVE_TTL.count())));
+
+	auto& limiter = RateLimiter::instance();
+	limiter.configure(_options);
+	limiter.setReloadSource(OPTIONS_INFO);
+	RateLimiter::installReloadSignal();
+
+	auto& pool = BufferPool::instance();
+	pool.setHugePages(_options.getBool("buffer_pool_huge_pages"));
+	pool.setMaxCachedBytes(_options.getUInt("buffer_pool_max_cached", BufferPool::DEFAULT_MAX_CACHED_BYTES));
+}
+
+/**
+ * Point _socketHandler to the session's server. The pool's strategy chooses only until the session is bound, or once
+ * its server backs off from connect failures. Nothing to do for a single server.
+ */
+bool ClientLogic::selectServer()
+{
+	if (_servers.size() <= 1)
+		return true;
+	_currentServer = (_sessionBound && _servers.isHealthy(_sessionServer)) ? _sessionServer : _servers.select(_self.id);
+	const auto server = _servers.server(_currentServer);
+	return _socketHandler->setSocketInfo(server.address, server.port);
+}
+
+/**
+ * Connect _socketHandler to the session's server. On connect errors, fail over to the next healthy server, where the
+ * session is moved to first (see moveSession).
+ * A failed server is skipped for a jittered, exponentially growing backoff. If all servers are backing off,
+ * wait for the first one to recover.
+ */
+bool ClientLogic::connectServer()
+{
+	if (_servers.size() <= 1)
+	{
+		if (_socketHandler->connect())
+			return true;
+		setCommunicationError();
+		return false;
+	}
+
+	if (!_serverSelected)
+		(void)selectServer();
+	_serverSelected = false;
+	for (size_t attempt = 1; ; ++attempt)
+	{
+		const bool moving = _sessionBound && (_currentServer != _sessionServer);
+		if ((!moving || moveSession()) && _socketHandler->connect())
+		{
+			_servers.onConnected(_currentServer);
+			bindSession();
+			return true;
+		}
+		if (_cancellation->isCancelled())
+		{
+			setCommunicationError();
+			return false;
+		}
+		_servers.onFailure(_currentServer);
+		if (attempt == MAX_FAILOVER_ATTEMPTS)
+			break;
+		std::this_thread::sleep_for(_servers.timeUntilHealthy());
+		(void)selectServer();
+	}
+	clearLastError();
+	_lastError << "Failed connecting to any of " << _servers.size() << " servers. Last tried " << _socketHandler;
+	return false;
+}
+
+/**
+ * Mark the request to the current server as completed.
+ */
+void ClientLogic::releaseServer()
+{
+	if (_servers.size() > 1)
+		_servers.onCompleted(_currentServer);
+}
+
+/**
+ * Whether the server last used accepts connections now, telling connect-level failures from failures of the requests
+ * sent. Of several servers, none is while all are backing off.
+ */
+bool ClientLogic::serverReachable()
+{
+	if (_servers.size() > 1 && _servers.timeUntilHealthy() > std::chrono::steady_clock::duration::zero())
+		return false;
+	SocketHandler probe;
+	probe.setCancellation(_cancellation);
+	return probe.setSocketInfo(_socketHandler->getAddress(), _socketHandler->getPort()) && probe.connect();
+}
+
+/**
+ * Bind the session to the server recorded in SESSION_INFO, if listed. Nothing to do for a single server.
+ * The following lines hold "address:port hexID" of the client's registrations with the other servers (replicas).
+ * Their session keys are exchanged again upon the first replicated upload.
+ */
+void ClientLogic::loadSession()
+{
+	FileHandler file;
+	std::string line;
+	if (_servers.size() <= 1 || !file.open(SESSION_INFO) || !file.readLine(line))
+		return;
+	Stringer::trim(line);
+	for (size_t i = 0; i < _servers.size(); ++i)
+	{
+		const auto server = _servers.server(i);
+		if (line == server.address + ':' + server.port)
+		{
+			_sessionServer = _currentServer = i;
+			_sessionBound = _socketHandler->setSocketInfo(server.address, server.port);
+			break;
+		}
+	}
+
+	while (file.readLine(line))
+	{
+		Stringer::trim(line);
+		const size_t separator = line.find(' ');
+		if (separator == std::string::npos)
+			continue;
+		const std::string id = Stringer::unhex(line.substr(separator + 1));
+		if (id.size() != sizeof(ClientID::uuid))
+			continue;
+		Session session;
+		memcpy(session.id.uuid, id.data(), sizeof(session.id.uuid));
+		_replicaSessions[line.substr(0, separator)] = session;
+	}
+}
+
+/**
+ * Keep the client on the connected server from now on, and record it in SESSION_INFO for following runs:
+ * registration, key exchange, uploads & CRC notices must all reach the server which holds the client's session.
+ */
+void ClientLogic::bindSession()
+{
+	if (_sessionBound && _sessionServer == _currentServer)
+		return;
+	_sessionServer = _currentServer;
+	_sessionBound = true;
+	storeSession();
+}
+
+/**
+ * Write the session's server & the replica IDs to SESSION_INFO. See loadSession.
+ */
+void ClientLogic::storeSession()
+{
+	FileHandler file;
+	const auto server = _servers.server(_sessionBound ? _sessionServer : _currentServer);
+	if (!file.open(SESSION_INFO, true) || !file.writeLine(server.address + ':' + server.port))
+		return;
+	for (const auto& [endpoint, session] : _replicaSessions)
+	{
+		if (!(session.id == ClientID()) && !file.writeLine(endpoint + ' ' + Stringer::hex(session.id.uuid, sizeof(session.id.uuid))))
+			return;
+	}
+}
+
+/**
+ * The session's server is unreachable & _currentServer was chosen instead. Client IDs & session keys are per server,
+ * so register there under the same username and exchange the public key again if one was exchanged before.
+ * CLIENT_INFO is updated. Requests built for the previous server are then refused by sessionMoved.
+ */
+bool ClientLogic::moveSession()
+{
+	if (_self.username.empty() || _self.id == ClientID())
+		return true;  // not registered yet. Nothing to move.
+
+	Tracer::Scope trace("ClientLogic::moveSession", "client");
+	const auto server = _servers.server(_currentServer);
+	const auto previous = _servers.server(_sessionServer);
+	const std::string endpoint = server.address + ':' + server.port;
+	SocketHandler socket;
+	socket.setCancellation(_cancellation);
+	Session session;  // a replica the client is registered with already keeps its ID.
+	const auto replica = _replicaSessions.find(endpoint);
+	if (replica != _replicaSessions.end())
+		session = replica->second;
+	std::string error;
+	if (!socket.setSocketInfo(server.address, server.port) ||
+		!openSession(socket, session, _self.symmetricKeySet && !session.keySet, error))
+		return false;
+
+	// The previous server becomes a replica, in case uploads are replicated or the session moves back.
+	_replicaSessions[previous.address + ':' + previous.port] = Session{ _self.id, _self.symmetricKey, _self.symmetricKeySet };
+	_replicaSessions.erase(endpoint);
+	_self.id = session.id;
+	if (session.keySet)
+		_self.symmetricKey = session.key;
+	_sessionMoves++;
+	if (!storeClientInfo() || (_rsaDecryptor != nullptr && !storeClientRSA()))
+		std::cout << "Warning: " << _lastError.str() << std::endl;
+	std::cout << "Server " << previous.address << ':' << previous.port << " is unreachable. Moved the session to " <<
+		endpoint << " instead." << std::endl;
+	return true;
+}
+
+/**
+ * Register under the client's username on socket's server unless session holds an ID already,
+ * and exchange the public key if exchangeKey. Does not touch _socketHandler & _lastError, so worker threads may use it.
+ * error describes a failure.
+ */
+bool ClientLogic::openSession(SocketHandler& socket, Session& session, const bool exchangeKey, std::string& error)
+{
+	if (session.id == ClientID())
+	{
+		RequestRegistration registration;
+		ResponseRegistrationSucceed registered;
+		registration.header.payloadSize = sizeof(registration.clientName);
+		strcpy_s(reinterpret_cast<char*>(registration.clientName.name), CLIENT_NAME_SIZE, _self.username.c_str());
+		if (!exchange(socket, registration, registered))
+		{
+			error = "registration failed";
+			return false;
+		}
+		session.id = registered.payload;
+		session.keySet = false;
+	}
+	if (!exchangeKey)
+		return true;
+
+	RequestSendPublicKey keyRequest;
+	ResponseEncryptedKey keyResponse;
+	keyRequest.header.clientId = session.id;
+	keyRequest.header.payloadSize = sizeof(keyRequest.payload);
+	strcpy_s(reinterpret_cast<char*>(keyRequest.payload.clientName.name), CLIENT_NAME_SIZE, _self.username.c_str());
+	{
+		std::lock_guard<std::mutex> lock(_rsaMutex);
+		if (_rsaDecryptor == nullptr)
+		{
+			error = "no RSA key pair";
+			return false;
+		}
+		const auto publicKey = _rsaDecryptor->getPublicKey();
+		memcpy(keyRequest.payload.clientPublicKey.publicKey, publicKey.c_str(), sizeof(keyRequest.payload.clientPublicKey.publicKey));
+	}
+	if (!exchange(socket, keyRequest, keyResponse))
+	{
+		error = "key exchange failed";
+		return false;
+	}
+	try
+	{
+		std::lock_guard<std::mutex> lock(_rsaMutex);
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_DECRYPT, ENCRYPTED_AES_KEY_SIZE);
+		session.keySet = (_rsaDecryptor->decrypt(std::span<const uint8_t>(keyResponse.payload.encryptedAESKey.encryptedAESKey, ENCRYPTED_AES_KEY_SIZE),
+			std::span<uint8_t>(session.key.symmetricKey, AES_KEY_SIZE)) == AES_KEY_SIZE);
+	}
+	catch (...) {} // keySet remains false.
+	if (!session.keySet)
+		error = "couldn't decrypt symmetric key";
+	return session.keySet;
+}
+
+/**
+ * Return true if a failover moved the session since moves was read. Requests built before carry the previous
+ * server's client ID & key, so the connection is dropped before sending them and the caller may build them again.
+ */
+bool ClientLogic::sessionMoved(const size_t moves)
+{
+	if (_sessionMoves == moves)
+		return false;
+	_socketHandler->close();
+	releaseServer();
+	const auto server = _servers.server(_currentServer);
+	clearLastError();
+	_lastError << "Session moved to " << server.address << ':' << server.port << " after a failover. Please retry.";
+	return true;
+}
+
 /**
  * Store client info to CLIENT_INFO file.
  */
@@ -310,10 +771,14 @@ bool ClientLogic::storeClientRSA()
 }
 
 /**
- * Validate ResponseHeader upon an expected ResponseCode.
+ * Validate ResponseHeader upon Response's code & payload size, both known at compile time.
  */
-bool ClientLogic::validateHeader(const ResponseHeader& header, const ResponseCode expectedCode)
+template <typename Response>
+bool ClientLogic::validateHeader(const ResponseHeader& header)
 {
+	constexpr code_t expectedCode = MessageDescriptor<Response>::code;
+	constexpr csize_t expectedSize = MessageDescriptor<Response>::payloadSize;
+
 	if (header.code == RESPONSE_ERROR)
 	{
 		clearLastError();
@@ -328,42 +793,6 @@ bool ClientLogic::validateHeader(const ResponseHeader& header, const ResponseCod
 		return false;
 	}
 
-	csize_t expectedSize = DEFAULT_VALUE;
-	switch (header.code)
-	{
-		case RESPONSE_REGISTRATION_SUCCESS:
-		{
-			expectedSize = sizeof(ResponseRegistrationSucceed);
-			break;
-		}
-		case RESPONSE_REGISTRATION_FAILED:
-		{
-			expectedSize = sizeof(ResponseRegistrationFailed);
-			break;
-		}
-		case RESPONSE_ENCRYPTED_AES_KEY:
-		{
-			expectedSize = sizeof(ResponseEncryptedKey);
-			break;
-		}
-		case RESPONSE_SUCCESS_FILE_WITH_CRC:
-		{
-			expectedSize = sizeof(ResponseFileAcception);
-			break;
-		}
-		case RESPONSE_MSG_RECEIVED_THANKS:
-		{
-			expectedSize = sizeof(ResponseMSGReceived);
-			break;
-		}
-		default:
-		{
-			return true;  // variable payload size. 
-		}
-	}
-	
-	expectedSize -= sizeof(ResponseHeader);
-
 	if (header.payloadSize != expectedSize)
 	{
 		clearLastError();
@@ -374,102 +803,269 @@ bool ClientLogic::validateHeader(const ResponseHeader& header, const ResponseCod
 }
 
 /**
- * Generate RSA key pair.
+ * Send a message which starts with Request and receive its Response. Validate the response's header.
+ * Message & response types are matched at compile time through MessageDescriptor.
+ * message must already be in wire byte order. response is converted to host byte order.
  */
-bool ClientLogic::generateRSAPair()
+template <typename Request, typename Response>
+bool ClientLogic::transact(const uint8_t* const message, const size_t size, Response& response)
 {
-	delete _rsaDecryptor;
-	_rsaDecryptor = new RSAPrivateWrapper();
-	const auto publicKey = _rsaDecryptor->getPublicKey();
-	if (publicKey.size() != PUBLIC_KEY_SIZE)
+	using Descriptor = MessageDescriptor<Request>;
+	static_assert(std::is_same_v<typename Descriptor::Response, Response>, "Unexpected response type for request");
+	static_assert(sizeof(Response) == sizeof(ResponseHeader) + MessageDescriptor<Response>::payloadSize, "Response size mismatch");
+
+	if (size < sizeof(Request) || (!Descriptor::variablePayload && size != sizeof(Request)))
 	{
 		clearLastError();
-		_lastError << "Invalid public key length!";
+		_lastError << "Invalid request size " << size;
 		return false;
 	}
-	memcpy(_self.publicKey.publicKey, publicKey.c_str(), sizeof(_self.publicKey));
-	if (!storeClientRSA())
+
+	const size_t moves = _sessionMoves;
+	if (_servers.size() > 1 && (!connectServer() || sessionMoved(moves)))
+		return false;  // error message updated within.
+	const bool received = _socketHandler->sendReceive(message, size, reinterpret_cast<uint8_t* const>(&response), sizeof(response));
+	releaseServer();
+	if (!received)
 	{
-		clearLastError();
-		_lastError << "Failed writing client RSA key to " << CLIENT_INFO << ".";
+		setCommunicationError();
 		return false;
 	}
-	return true;
+	Serializer::fromWire<Response>(reinterpret_cast<uint8_t*>(&response));
+
+	if constexpr (requires { typename Descriptor::Failure; })
+	{
+		if (response.header.code == MessageDescriptor<typename Descriptor::Failure>::code)
+		{
+			if (!validateHeader<typename Descriptor::Failure>(response.header))
+				return false;  // error message updated within.
+			clearLastError();
+			_lastError << Descriptor::name << " failed.";
+			return false;
+		}
+	}
+
+	return validateHeader<Response>(response.header);
+}
+
+template <typename Request, typename Response>
+bool ClientLogic::transact(const Request& request, Response& response)
+{
+	static_assert(!MessageDescriptor<Request>::variablePayload, "Variable payload requests must be sent as a message buffer");
+	if constexpr (Serializer::NATIVE_WIRE_ORDER)
+	{
+		return transact<Request>(reinterpret_cast<const uint8_t* const>(&request), sizeof(request), response);
+	}
+	else
+	{
+		uint8_t wire[sizeof(Request)];
+		memcpy(wire, &request, sizeof(request));
+		Serializer::toWire<Request>(wire);
+		return transact<Request>(wire, sizeof(wire), response);
+	}
 }
 
 /**
- * Change RSA key pair.
+ * Send a single request on the current connection, in wire byte order.
  */
-bool ClientLogic::changeRSAPair()
+template <typename Request>
+bool ClientLogic::sendRequest(const Request& request)
 {
-	if (!storeClientInfo())
+	static_assert(!MessageDescriptor<Request>::variablePayload, "Variable payload requests must be sent as a message buffer");
+	uint8_t wire[sizeof(Request)];
+	memcpy(wire, &request, sizeof(request));
+	Serializer::toWire<Request>(wire);
+	if (!_socketHandler->send(wire, sizeof(wire)))
 	{
-		clearLastError();
-		_lastError << "Failed writing client info to " << CLIENT_INFO << ".";
+		setCommunicationError();
 		return false;
 	}
-
-	generateRSAPair();
 	return true;
 }
 
 /**
- * Register client via the server.
+ * Receive & validate the next response on the current connection.
  */
-bool ClientLogic::registerClient(const std::string& username)
+template <typename Response>
+bool ClientLogic::receiveResponse(Response& response)
 {
-	RequestRegistration  request;
-	ResponseRegistrationSucceed response;
+	size_t received = 0;
+	if (!_socketHandler->receiveResponse(reinterpret_cast<uint8_t* const>(&response), sizeof(response), received))
+	{
+		setCommunicationError();
+		return false;
+	}
+	Serializer::fromWire<Response>(reinterpret_cast<uint8_t*>(&response));
+	return validateHeader<Response>(response.header);
+}
 
-	if (username.length() >= CLIENT_NAME_SIZE)  // >= because of null termination.
+/**
+ * Submit a request on a new stream of session, in wire byte order. A response is awaited unless Request has none.
+ */
+template <typename Request>
+stream_t ClientLogic::submitRequest(MultiplexedSession& session, const Request& request)
+{
+	static_assert(!MessageDescriptor<Request>::variablePayload, "Variable payload requests must be sent as a message buffer");
+	uint8_t wire[sizeof(Request)];
+	memcpy(wire, &request, sizeof(request));
+	Serializer::toWire<Request>(wire);
+	return session.submit(wire, sizeof(wire), !std::is_void_v<typename MessageDescriptor<Request>::Response>);
+}
+
+/**
+ * Parse & validate a response reassembled from a stream of a multiplexed session.
+ */
+template <typename Response>
+bool ClientLogic::parseResponse(const std::vector<uint8_t>& message, Response& response)
+{
+	if (message.size() < sizeof(ResponseHeader) || message.size() > sizeof(response))
 	{
 		clearLastError();
-		_lastError << "Invalid username length!";
+		_lastError << "Invalid response size " << message.size();
 		return false;
 	}
-	for (auto ch : username)
+	memcpy(&response, message.data(), message.size());
+	Serializer::fromWire<Response>(reinterpret_cast<uint8_t*>(&response));
+	if (!validateHeader<Response>(response.header))
+		return false;  // error message updated within.
+	if (message.size() != sizeof(response))
 	{
-		if (!std::isalnum(ch) && ch != ' ')  // check that username is alphanumeric. [a-zA-Z0-9].
-		{
-			clearLastError();
-			_lastError << "Invalid username! Username may only contain letters and numbers and a space!";
-			return false;
-		}
+		clearLastError();
+		_lastError << "Invalid response size " << message.size();
+		return false;
 	}
+	return true;
+}
 
-	// fill request data
-	request.header.payloadSize = sizeof(request.clientName);
-	strcpy_s(reinterpret_cast<char*>(request.clientName.name), CLIENT_NAME_SIZE, username.c_str());
-	if (!_socketHandler->sendReceive(reinterpret_cast<const uint8_t* const>(&request), sizeof(request),
-		reinterpret_cast<uint8_t* const>(&response), sizeof(response)))
+/**
+ * Send a request which the server does not reply to.
+ */
+template <typename Request>
+bool ClientLogic::transact(const Request& request)
+{
+	static_assert(std::is_void_v<typename MessageDescriptor<Request>::Response>, "Request expects a response");
+	uint8_t wire[sizeof(Request)];
+	memcpy(wire, &request, sizeof(request));
+	Serializer::toWire<Request>(wire);
+	const size_t moves = _sessionMoves;
+	if (_servers.size() > 1 && (!connectServer() || sessionMoved(moves)))
+		return false;  // error message updated within.
+	const bool sent = _socketHandler->sendOnly(wire, sizeof(wire));
+	releaseServer();
+	if (!sent)
+	{
+		setCommunicationError();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Convert a received Response from wire byte order and check its code & size.
+ */
+template <typename Response>
+bool ClientLogic::checkResponse(Response& response)
+{
+	Serializer::fromWire<Response>(reinterpret_cast<uint8_t*>(&response));
+	return (response.header.code == MessageDescriptor<Response>::code) &&
+		(response.header.payloadSize == MessageDescriptor<Response>::payloadSize);
+}
+
+/**
+ * Send a message (wire byte order) on socket and receive its Response, which is checked by code & size only.
+ * Unlike transact, does not touch _socketHandler & _lastError, so worker threads may use it.
+ */
+template <typename Response>
+bool ClientLogic::exchange(SocketHandler& socket, const uint8_t* const message, const size_t size, Response& response)
+{
+	return socket.sendReceive(message, size, reinterpret_cast<uint8_t* const>(&response), sizeof(response)) &&
+		checkResponse(response);
+}
+
+template <typename Request>
+bool ClientLogic::exchange(SocketHandler& socket, const Request& request, typename MessageDescriptor<Request>::Response& response)
+{
+	static_assert(!MessageDescriptor<Request>::variablePayload, "Variable payload requests must be sent as a message buffer");
+	uint8_t wire[sizeof(Request)];
+	memcpy(wire, &request, sizeof(request));
+	Serializer::toWire<Request>(wire);
+	return exchange(socket, wire, sizeof(wire), response);
+}
+
+/**
+ * Generate RSA key pair.
+ */
+bool ClientLogic::generateRSAPair()
+{
+	delete _rsaDecryptor;
+	_rsaDecryptor = new RSAPrivateWrapper();
+	const auto publicKey = _rsaDecryptor->getPublicKey();
+	if (publicKey.size() != PUBLIC_KEY_SIZE)
+	{
+		clearLastError();
+		_lastError << "Invalid public key length!";
+		return false;
+	}
+	memcpy(_self.publicKey.publicKey, publicKey.c_str(), sizeof(_self.publicKey));
+	if (!storeClientRSA())
 	{
 		clearLastError();
-		_lastError << "Failed communicating with server on " << _socketHandler;
+		_lastError << "Failed writing client RSA key to " << CLIENT_INFO << ".";
 		return false;
 	}
+	return true;
+}
 
-	if (response.header.code == RESPONSE_REGISTRATION_FAILED)
+/**
+ * Change RSA key pair.
+ */
+bool ClientLogic::changeRSAPair()
+{
+	if (!storeClientInfo())
 	{
-		ResponseRegistrationFailed responseFail;
-		responseFail.header.code = response.header.code;
-		responseFail.header.version = response.header.version;
-		responseFail.header.payloadSize = response.header.payloadSize;
+		clearLastError();
+		_lastError << "Failed writing client info to " << CLIENT_INFO << ".";
+		return false;
+	}
 
-		// Validate ResponseRegistrationFailed
-		if (!validateHeader(responseFail.header, RESPONSE_REGISTRATION_FAILED))
-			return false;  // error message updated within.
+	generateRSAPair();
+	for (auto& replica : _replicaSessions)
+		replica.second.keySet = false;  // exchanged with the previous public key.
+	return true;
+}
+
+/**
+ * Register client via the server.
+ */
+bool ClientLogic::registerClient(const std::string& username)
+{
+	Tracer::Scope trace("ClientLogic::registerClient", "client");
+	Metrics::TransferScope transfer("registerClient");
+	RequestRegistration  request;
+	ResponseRegistrationSucceed response;
 
+	if (username.length() >= CLIENT_NAME_SIZE)  // >= because of null termination.
+	{
 		clearLastError();
-		_lastError << "Registration failed.";
+		_lastError << "Invalid username length!";
 		return false;
 	}
-	else
+	for (auto ch : username)
 	{
-		// Validate ResponseRegistrationSucceed
-		if (!validateHeader(response.header, RESPONSE_REGISTRATION_SUCCESS))
-			return false;  // error message updated within.
+		if (!std::isalnum(ch) && ch != ' ')  // check that username is alphanumeric. [a-zA-Z0-9].
+		{
+			clearLastError();
+			_lastError << "Invalid username! Username may only contain letters and numbers and a space!";
+			return false;
+		}
 	}
 
+	// fill request data
+	request.header.payloadSize = sizeof(request.clientName);
+	strcpy_s(reinterpret_cast<char*>(request.clientName.name), CLIENT_NAME_SIZE, username.c_str());
+	if (!transact(request, response))
+		return false;  // error message updated within.
+
 	// Store received client's ID
 	_self.id = response.payload;
 	_self.username = username;
@@ -479,6 +1075,7 @@ bool ClientLogic::registerClient(const std::string& username)
 		_lastError << "Failed writing client info to " << CLIENT_INFO << ". Please register again with different username.";
 		return false;
 	}
+	transfer.setSuccess(true);
 	return true;
 }
 
@@ -487,6 +1084,8 @@ bool ClientLogic::registerClient(const std::string& username)
  */
 bool ClientLogic::sendPublicKey()
 {
+	Tracer::Scope trace("ClientLogic::sendPublicKey", "client");
+	Metrics::TransferScope transfer("sendPublicKey");
 	RequestSendPublicKey request;
 	ResponseEncryptedKey response;
 
@@ -495,29 +1094,30 @@ bool ClientLogic::sendPublicKey()
 	strcpy_s(reinterpret_cast<char*>(request.payload.clientName.name), CLIENT_NAME_SIZE, _self.username.c_str());
 	memcpy(request.payload.clientPublicKey.publicKey, publicKey.c_str(), sizeof(request.payload.clientPublicKey.publicKey));
 	_self.publicKey = request.payload.clientPublicKey;
-	if (!_socketHandler->sendReceive(reinterpret_cast<const uint8_t* const>(&request), sizeof(request),
-		reinterpret_cast<uint8_t* const>(&response), sizeof(response)))
-	{
-		clearLastError();
-		_lastError << "Failed communicating with server on " << _socketHandler;
-		return false;
-	}
-	
-	// Validate ResponseEncryptedKey
-	if (!validateHeader(response.header, RESPONSE_ENCRYPTED_AES_KEY))
+	if (!transact(request, response))
 		return false;  // error message updated within.
 
-	std::string key;
+	// Decrypt straight into the stored symmetric key.
+	size_t keySize = 0;
 	try
 	{
-		key = _rsaDecryptor->decrypt(response.payload.encryptedAESKey.encryptedAESKey, ENCRYPTED_AES_KEY_SIZE);
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_DECRYPT, ENCRYPTED_AES_KEY_SIZE);
+		keySize = _rsaDecryptor->decrypt(std::span<const uint8_t>(response.payload.encryptedAESKey.encryptedAESKey, ENCRYPTED_AES_KEY_SIZE),
+			std::span<uint8_t>(_self.symmetricKey.symmetricKey, AES_KEY_SIZE));
 	}
 	catch (std::exception& e)
 	{
 		std::cout << "Standard exception: " << e.what() << std::endl;
 	}
-	memcpy(_self.symmetricKey.symmetricKey, key.c_str(), AES_KEY_SIZE);
+	if (keySize != AES_KEY_SIZE)
+	{
+		_self.symmetricKeySet = false;
+		clearLastError();
+		_lastError << "Couldn't decrypt symmetric key received from server.";
+		return false;
+	}
 	_self.symmetricKeySet = true;
+	transfer.setSuccess(true);
 	return true;
 }
 
@@ -526,8 +1126,17 @@ bool ClientLogic::sendPublicKey()
  */
 uint32_t ClientLogic::getCRC(const std::string& str)
 {
+	return getCRC(reinterpret_cast<const uint8_t*>(str.c_str()), str.size());
+}
+
+/**
+ * Calculate crc of size bytes from buffer.
+ */
+uint32_t ClientLogic::getCRC(const uint8_t* buffer, const size_t size)
+{
+	Tracer::Scope trace("ClientLogic::getCRC", "client");
 	boost::crc_32_type result;
-	result.process_bytes(str.c_str(), str.size());
+	result.process_bytes(buffer, size);
 	return result.checksum();
 }
 
@@ -541,16 +1150,7 @@ bool ClientLogic::informServerCRCValidated(uint8_t* fileName)
 
 	memcpy(request.file.fileName, fileName, FILE_NAME_SIZE);
 
-	if (!_socketHandler->sendReceive(reinterpret_cast<const uint8_t* const>(&request), sizeof(request),
-		reinterpret_cast<uint8_t* const>(&response), sizeof(response)))
-	{
-		clearLastError();
-		_lastError << "Failed communicating with server on " << _socketHandler;
-		return false;
-	}
-
-	// Validate ResponseMSGReceived
-	if (!validateHeader(response.header, RESPONSE_MSG_RECEIVED_THANKS))
+	if (!transact(request, response))
 		return false;  // error message updated within.
 
 	_self.validCRC = true;
@@ -568,16 +1168,7 @@ void ClientLogic::informServerCRCFailed(const size_t size)
 		RequestInvalidCRCAbort request(_self.id);
 		ResponseMSGReceived response;
 
-		if (!_socketHandler->sendReceive(reinterpret_cast<const uint8_t* const>(&request), sizeof(request),
-			reinterpret_cast<uint8_t* const>(&response), sizeof(response)))
-		{
-			clearLastError();
-			_lastError << "Failed communicating with server on " << _socketHandler;
-			return;
-		}
-
-		// Validate ResponseMSGReceived
-		if (!validateHeader(response.header, RESPONSE_MSG_RECEIVED_THANKS))
+		if (!transact(request, response))
 			return;  // error message updated within.
 
 		std::cout << "Server has received CRC fail message." << std::endl;
@@ -586,22 +1177,69 @@ void ClientLogic::informServerCRCFailed(const size_t size)
 	{
 		RequestInvalidCRC request(_self.id);
 
-		if (!_socketHandler->sendOnly(reinterpret_cast<const uint8_t* const>(&request), sizeof(request)))
+		if (!transact(request))
+			return;  // error message updated within.
+	}
+}
+
+/**
+ * Read, CRC & encrypt a file into a ready to send RequestSendFile message (wire byte order).
+ * All buffers are drawn from the pool.
+ */
+bool ClientLogic::prepareFile(const std::string& filePath, BufferPool::Buffer& message, uint32_t& crc)
+{
+	RequestSendFile request(_self.id);
+	if (filePath.length() >= FILE_NAME_SIZE)
+	{
+		clearLastError();
+		_lastError << "Invalid file name length: " << filePath;
+		return false;
+	}
+	strcpy_s(reinterpret_cast<char*>(request.PayloadHeader.file.fileName), FILE_NAME_SIZE, filePath.c_str());
+
+	BufferPool::Buffer file;
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_READ);
+		if (!_fileHandler->readAtOnce(filePath, file))
 		{
 			clearLastError();
-			_lastError << "Failed communicating with server on " << _socketHandler;
-			return;
+			_lastError << "File not found!";
+			return false;
 		}
+		phase.addBytes(file.size());
+	}
+
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_CRC, file.size());
+		crc = getCRC(file.data(), file.size());
 	}
+
+	// Cipher size is known upfront, so encrypt straight after the request header.
+	request.PayloadHeader.contentSize = static_cast<csize_t>(AESWrapper::cipherSize(file.size()));
+	request.header.payloadSize = sizeof(request.PayloadHeader) + request.PayloadHeader.contentSize;
+	message = BufferPool::instance().acquire(sizeof(request) + request.PayloadHeader.contentSize);
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_ENCRYPT, file.size());
+		AESWrapper aes(_self.symmetricKey);
+		(void)aes.encrypt(std::span<const uint8_t>(file.data(), file.size()),
+			std::span<uint8_t>(message.data() + sizeof(request), request.PayloadHeader.contentSize));
+	}
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_ASSEMBLE, sizeof(request));
+		memcpy(message.data(), &request, sizeof(request));
+		Serializer::toWire<RequestSendFile>(message.data());  // cipher text bytes are sent as is.
+	}
+	return true;
 }
 
 /**
- * Send a file to the server.
+ * Send the file listed in SERVER_INFO to the server.
  */
 bool ClientLogic::sendFile(bool& sent)
 {
-	RequestSendFile request(_self.id);
-	ResponseFileAcception response;
+	Tracer::Scope trace("ClientLogic::sendFile", "client");
+	Metrics::TransferScope transfer("sendFile");
+	const CancellationToken::DeadlineScope deadline(*_cancellation, _transferTimeout);
 
 	std::string filePath;
 
@@ -609,69 +1247,1134 @@ bool ClientLogic::sendFile(bool& sent)
 		return false;
 	}
 
+	const bool success = uploadFile(filePath, sent);
+	transfer.setSuccess(success);
+	return success;
+}
+
+/**
+ * Send a file to the server. sent is set once the server accepted the file, whether or not its CRC matched.
+ * If a failover moved the session before the file was sent, it is prepared again for the new server, once.
+ */
+bool ClientLogic::uploadFile(const std::string& filePath, bool& sent)
+{
+	const size_t moves = _sessionMoves;
+	const bool success = uploadOnce(filePath, sent);
+	if (success || sent || _sessionMoves == moves)
+		return success;
+	return uploadOnce(filePath, sent);
+}
+
+/**
+ * Send a file to the session's server. See uploadFile.
+ */
+bool ClientLogic::uploadOnce(const std::string& filePath, bool& sent)
+{
+	ResponseFileAcception response;
+	if (_replicate && _servers.size() > 1)
+	{
+		// Retries are done per server within. sent stays false, so the caller does not retry all servers.
+		_self.validCRC = sendReplicated(filePath);
+		return _self.validCRC;
+	}
+
+	// Resolve & connect while the file is read, CRCed and encrypted.
+	if (_speculativeConnect)
+	{
+		_serverSelected = selectServer();
+		_socketHandler->preconnect();
+	}
+
+	uint32_t fileCRC;
+	if (_stagedUpload && _stripeConnections == 1)
+	{
+		if (!sendStaged(filePath, response, fileCRC))
+			return false;  // error message updated within.
+	}
+	else
+	{
+		BufferPool::Buffer msgToSend;
+		if (!prepareFile(filePath, msgToSend, fileCRC))
+		{
+			_socketHandler->close();
+			_serverSelected = false;
+			return false;  // error message updated within.
+		}
+
+		const size_t stripes = stripeCount(msgToSend.size() - sizeof(RequestSendFile));
+		if (stripes > 1)
+		{
+			_socketHandler->close();  // stripes use connections of their own.
+			if (!sendStriped(msgToSend, stripes, response))
+				return false;  // error message updated within.
+		}
+		else if (!transact<RequestSendFile>(msgToSend.data(), msgToSend.size(), response))
+		{
+			return false;  // error message updated within.
+		}
+	}
+
+	sent = true;
+	if (fileCRC == response.PayloadHeader.crc)
+	{
+		informServerCRCValidated(response.PayloadHeader.file.fileName);
+	}
+	else
+	{
+		_self.validCRC = false;
+		clearLastError();
+		_lastError << "CRC validation with server has failed.";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Upload a file through an UploadPipeline, so reading, CRC & encryption overlap with sending.
+ * The whole file is never held in memory.
+ */
+bool ClientLogic::sendStaged(const std::string& filePath, ResponseFileAcception& response, uint32_t& crc)
+{
+	RequestSendFile request(_self.id);
+	if (filePath.length() >= FILE_NAME_SIZE)
+	{
+		clearLastError();
+		_lastError << "Invalid file name length: " << filePath;
+		return false;
+	}
 	strcpy_s(reinterpret_cast<char*>(request.PayloadHeader.file.fileName), FILE_NAME_SIZE, filePath.c_str());
 
-	uint8_t* file = nullptr;
-	size_t bytes;
-	if (!_fileHandler->readAtOnce(filePath, file, bytes))
+	const size_t fileSize = _fileHandler->open(filePath) ? _fileHandler->size() : 0;
+	_fileHandler->close();
+	if (fileSize == 0)
 	{
+		_socketHandler->close();
+		_serverSelected = false;
 		clearLastError();
 		_lastError << "File not found!";
 		return false;
 	}
+	request.PayloadHeader.contentSize = static_cast<csize_t>(AESWrapper::cipherSize(fileSize));
+	request.header.payloadSize = sizeof(request.PayloadHeader) + request.PayloadHeader.contentSize;
+	uint8_t header[sizeof(request)];
+	memcpy(header, &request, sizeof(request));
+	Serializer::toWire<RequestSendFile>(header);
+
+	const size_t moves = _sessionMoves;
+	if (!connectServer() || sessionMoved(moves))
+		return false;  // error message updated within.
+	const auto start = std::chrono::steady_clock::now();
+	if (!_uploadPipeline)
+		_uploadPipeline = std::make_unique<UploadPipeline>(_stagedChunkSize, _stagedQueueDepth, _ioUring);
+	const auto result = _uploadPipeline->send(*_socketHandler, filePath, fileSize, _self.symmetricKey, header, sizeof(header), crc);
+	bool success = (result == UploadPipeline::EResult::RESULT_OK);
+	if (success)
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_RESPONSE_WAIT, sizeof(response));
+		success = receiveResponse(response);  // error message updated within.
+	}
+	else if (result == UploadPipeline::EResult::RESULT_READ_FAILED)
+	{
+		clearLastError();
+		_lastError << "Failed reading " << filePath;
+	}
+	else if (result == UploadPipeline::EResult::RESULT_START_FAILED)
+	{
+		clearLastError();
+		_lastError << "Failed starting the staged upload of " << filePath;
+	}
+	else
+	{
+		setCommunicationError();
+	}
+	_socketHandler->close();
+	releaseServer();
+	if (success)
+		Metrics::instance().recordLatency(REQUEST_SEND_FILE, Metrics::ELatency::LATENCY_ROUND_TRIP, Metrics::elapsedNanos(start));
+	return success;
+}
+
+/**
+ * Send all files listed in SERVER_INFO over a single multiplexed or pipelined connection, small files packed if enabled.
+ */
+bool ClientLogic::sendFiles()
+{
+	Tracer::Scope trace("ClientLogic::sendFiles", "client");
+	Metrics::TransferScope transfer("sendFiles");
+	std::vector<std::string> filePaths;
+	if (!parseFileNames(filePaths))
+		return false;
+
+	std::vector<bool> validated;
+	const bool success = sendBatch(filePaths, validated);
+	_self.validCRC = success;
+	const auto count = std::count(validated.begin(), validated.end(), true);
+	if (!success && count > 0)
+		_lastError << " (" << count << " of " << filePaths.size() << " files validated)";
+	transfer.setSuccess(success);
+	return success;
+}
+
+/**
+ * Keep up to _pipelineDepth requests in flight on one connection. Responses arrive in request order.
+ * Requests are only held back by their own dependencies: a file's RequestValidCRC waits for that file's
+ * ResponseFileAcception, but the next files' uploads are already on the wire.
+ * A file whose CRC mismatches is resent up to MAX_FILE_RESEND_RETRIES times.
+ */
+bool ClientLogic::sendPipelined(const std::vector<std::string>& filePaths, std::vector<bool>& validated)
+{
+	struct InFlight
+	{
+		code_t                                code;
+		size_t                                file;
+		uint32_t                              crc;
+		size_t                                bytes;
+		std::chrono::steady_clock::time_point sentAt;
+	};
+
+	validated.assign(filePaths.size(), false);
+	std::deque<InFlight> inFlight;
+	std::deque<size_t> pending;
+	std::vector<size_t> retries(filePaths.size(), MAX_FILE_RESEND_RETRIES);
+	for (size_t i = 0; i < filePaths.size(); ++i)
+		pending.push_back(i);
+
+	if (!connectServer())
+		return false;  // error message updated within.
+
+	auto& metrics = Metrics::instance();
+	bool success = true;
+	while (!pending.empty() || !inFlight.empty())
+	{
+		// Fill the window with file uploads.
+		while (!pending.empty() && inFlight.size() < _concurrency.limit(_pipelineDepth))
+		{
+			const size_t index = pending.front();
+			pending.pop_front();
+			BufferPool::Buffer message;
+			uint32_t crc;
+			if (!prepareFile(filePaths[index], message, crc))
+			{
+				success = false;  // skip this file. error message updated within.
+				continue;
+			}
+			Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, message.size());
+			if (!_socketHandler->send(message.data(), message.size()))
+			{
+				_concurrency.onFailure();
+				_socketHandler->close();
+				releaseServer();
+				setCommunicationError();
+				return false;
+			}
+			inFlight.push_back({ REQUEST_SEND_FILE, index, crc, message.size(), std::chrono::steady_clock::now() });
+		}
+		if (inFlight.empty())
+			break;
+
+		const InFlight request = inFlight.front();
+		inFlight.pop_front();
+		bool received;
+		if (request.code == REQUEST_SEND_FILE)
+		{
+			ResponseFileAcception response;
+			{
+				Metrics::PhaseScope phase(Metrics::EPhase::PHASE_RESPONSE_WAIT, sizeof(response));
+				received = receiveResponse(response);
+			}
+			if (!received)
+			{
+				_concurrency.onFailure();
+				break;  // error message updated within.
+			}
+			const uint64_t latency = Metrics::elapsedNanos(request.sentAt);
+			metrics.recordLatency(request.code, Metrics::ELatency::LATENCY_ROUND_TRIP, latency);
+			_concurrency.onSuccess(request.bytes, latency);
+
+			if (response.PayloadHeader.crc == request.crc)
+			{
+				RequestValidCRC valid(_self.id);
+				memcpy(valid.file.fileName, response.PayloadHeader.file.fileName, FILE_NAME_SIZE);
+				if (!sendRequest(valid))
+					break;
+				inFlight.push_back({ REQUEST_SEND_VALID_CRC, request.file, request.crc, sizeof(valid), std::chrono::steady_clock::now() });
+			}
+			else if (retries[request.file] > 0)
+			{
+				retries[request.file]--;
+				if (!sendRequest(RequestInvalidCRC(_self.id)))
+					break;
+				pending.push_front(request.file);  // resend next.
+			}
+			else
+			{
+				if (!sendRequest(RequestInvalidCRCAbort(_self.id)))
+					break;
+				inFlight.push_back({ REQUEST_INVALID_CRC_FOURTH_TIME, request.file, request.crc, sizeof(RequestInvalidCRCAbort), std::chrono::steady_clock::now() });
+			}
+		}
+		else
+		{
+			ResponseMSGReceived response;
+			{
+				Metrics::PhaseScope phase(Metrics::EPhase::PHASE_RESPONSE_WAIT, sizeof(response));
+				received = receiveResponse(response);
+			}
+			if (!received)
+				break;  // error message updated within.
+			metrics.recordLatency(request.code, Metrics::ELatency::LATENCY_ROUND_TRIP, Metrics::elapsedNanos(request.sentAt));
+
+			if (request.code == REQUEST_SEND_VALID_CRC)
+			{
+				validated[request.file] = true;
+			}
+			else
+			{
+				success = false;
+				clearLastError();
+				_lastError << "CRC validation with server has failed for " << filePaths[request.file];
+			}
+		}
+	}
+	_socketHandler->close();
+	releaseServer();
+	return success && pending.empty() && inFlight.empty() && std::find(validated.begin(), validated.end(), false) == validated.end();
+}
+
+/**
+ * Upload up to _multiplexStreams files concurrently as streams of one multiplexed session.
+ * Frames of all streams interleave, so small files and CRC acknowledgements are not held back by large uploads.
+ * Unlike pipelining, completions arrive in any order. If the server refuses the session, files are sent pipelined.
+ */
+bool ClientLogic::sendMultiplexed(const std::vector<std::string>& filePaths, std::vector<bool>& validated)
+{
+	struct InFlight
+	{
+		code_t code;
+		size_t file;
+		uint32_t crc;
+	};
+
+	validated.assign(filePaths.size(), false);
+	std::map<stream_t, InFlight> inFlight;
+	std::deque<size_t> pending;
+	std::vector<size_t> retries(filePaths.size(), MAX_FILE_RESEND_RETRIES);
+	for (size_t i = 0; i < filePaths.size(); ++i)
+		pending.push_back(i);
+
+	if (!connectServer())
+		return false;  // error message updated within.
+
+	MultiplexedSession session(*_socketHandler);
+	if (!session.open(_self.id))
+	{
+		_socketHandler->close();
+		releaseServer();
+		if (_cancellation->isCancelled())
+		{
+			setCommunicationError();
+			return false;
+		}
+		return sendPipelined(filePaths, validated);  // e.g. a server which speaks classic requests only.
+	}
+	size_t uploading = 0;
+	bool success = true;
+	while (true)
+	{
+		// Open a stream per file, up to the concurrency limit.
+		while (!pending.empty() && uploading < _concurrency.limit(_multiplexStreams))
+		{
+			const size_t index = pending.front();
+			pending.pop_front();
+			BufferPool::Buffer message;
+			uint32_t crc;
+			if (!prepareFile(filePaths[index], message, crc))
+			{
+				success = false;  // skip this file. error message updated within.
+				continue;
+			}
+			inFlight[session.submit(std::move(message), true)] = { REQUEST_SEND_FILE, index, crc };
+			uploading++;
+		}
+		if (session.outstanding() == 0)
+			break;
 
-	std::string temp = (char*)file;
-	std::string textBeforeEnc = temp.substr(0, bytes);
+		MultiplexedSession::Completion completion;
+		if (!session.next(completion))
+		{
+			_concurrency.onFailure();
+			success = false;
+			setCommunicationError();
+			break;
+		}
+		const auto it = inFlight.find(completion.streamId);
+		if (it == inFlight.end())
+			continue;
+		const InFlight request = it->second;
+		inFlight.erase(it);
+		if (request.code == REQUEST_SEND_FILE)
+			uploading--;
+		if (completion.reset)
+		{
+			_concurrency.onFailure();
+			success = false;
+			clearLastError();
+			_lastError << "Server reset the stream of " << filePaths[request.file];
+			continue;
+		}
+
+		if (request.code == REQUEST_SEND_FILE)
+		{
+			ResponseFileAcception response;
+			if (!parseResponse(completion.response, response))
+			{
+				_concurrency.onFailure();
+				success = false;  // error message updated within.
+				continue;
+			}
+			_concurrency.onSuccess(completion.requestBytes, completion.latencyNanos);
+			if (response.PayloadHeader.crc == request.crc)
+			{
+				RequestValidCRC valid(_self.id);
+				memcpy(valid.file.fileName, response.PayloadHeader.file.fileName, FILE_NAME_SIZE);
+				inFlight[submitRequest(session, valid)] = { REQUEST_SEND_VALID_CRC, request.file, request.crc };
+			}
+			else if (retries[request.file] > 0)
+			{
+				retries[request.file]--;
+				inFlight[submitRequest(session, RequestInvalidCRC(_self.id))] = { REQUEST_INVALID_CRC, request.file, request.crc };
+				pending.push_front(request.file);  // resend next.
+			}
+			else
+			{
+				inFlight[submitRequest(session, RequestInvalidCRCAbort(_self.id))] = { REQUEST_INVALID_CRC_FOURTH_TIME, request.file, request.crc };
+			}
+		}
+		else if (request.code != REQUEST_INVALID_CRC)  // RequestInvalidCRC completes once sent.
+		{
+			ResponseMSGReceived response;
+			if (!parseResponse(completion.response, response))
+			{
+				success = false;  // error message updated within.
+			}
+			else if (request.code == REQUEST_SEND_VALID_CRC)
+			{
+				validated[request.file] = true;
+			}
+			else
+			{
+				success = false;
+				clearLastError();
+				_lastError << "CRC validation with server has failed for " << filePaths[request.file];
+			}
+		}
+	}
+	_socketHandler->close();
+	releaseServer();
+	return success && std::find(validated.begin(), validated.end(), false) == validated.end();
+}
+
+/**
+ * Number of stripes to split contentSize bytes into. Each stripe holds at least MIN_STRIPE_SIZE bytes.
+ * In auto mode (0) the count follows the content size, up to MAX_STRIPES or the adaptive concurrency window.
+ */
+size_t ClientLogic::stripeCount(const size_t contentSize)
+{
+	const size_t connections = (_stripeConnections == 0) ? _concurrency.limit(MAX_STRIPES) : _stripeConnections;
+	return std::max<size_t>(1, std::min(connections, contentSize / MIN_STRIPE_SIZE));
+}
+
+/**
+ * Upload a prepared RequestSendFile message as stripes over parallel connections, then commit it.
+ * Each stripe carries its offset within the content so the server can reassemble in any arrival order.
+ * The commit's ResponseFileAcception holds the CRC of the whole file, which is verified by the caller as usual.
+ */
+bool ClientLogic::sendStriped(const BufferPool::Buffer& message, const size_t stripes, ResponseFileAcception& response)
+{
+	Tracer::Scope trace("ClientLogic::sendStriped", "client");
+	if (!_serverSelected)
+		_serverSelected = selectServer();  // stripes & commit must reach the same server.
+	if (!_serverSelected)
+	{
+		clearLastError();
+		_lastError << "Failed selecting one of " << _servers.size() << " servers for a striped upload.";
+		return false;
+	}
+	decltype(RequestSendFile::PayloadHeader) source;
+	memcpy(&source, message.data() + offsetof(RequestSendFile, PayloadHeader), sizeof(source));
+	source.contentSize = Serializer::wire(source.contentSize);
+	const uint8_t* const content = message.data() + sizeof(RequestSendFile);
+	const size_t contentSize = source.contentSize;
+	const size_t stripeSize = contentSize / stripes;
+
+	std::vector<uint8_t> acknowledged(stripes, false);
+	std::vector<std::jthread> workers;  // joined when cleared.
+	workers.reserve(stripes);
+	try
+	{
+		for (size_t i = 0; i < stripes; ++i)
+		{
+			workers.emplace_back([&, i]()
+			{
+				RequestSendFileStripe request(_self.id);
+				request.PayloadHeader.contentSize = source.contentSize;
+				request.PayloadHeader.file = source.file;
+				request.PayloadHeader.offset = static_cast<csize_t>(i * stripeSize);
+				request.PayloadHeader.stripeSize = static_cast<csize_t>((i + 1 == stripes) ? (contentSize - i * stripeSize) : stripeSize);
+				request.header.payloadSize = sizeof(request.PayloadHeader) + request.PayloadHeader.stripeSize;
+
+				// The stripe's range is sent straight from message, gathered after its header.
+				uint8_t header[sizeof(request)];
+				memcpy(header, &request, sizeof(request));
+				Serializer::toWire<RequestSendFileStripe>(header);
+
+				try
+				{
+					SocketHandler socket;
+					socket.setCancellation(_cancellation);
+					ResponseMSGReceived ack;
+					const auto start = std::chrono::steady_clock::now();
+					if (!socket.setSocketInfo(_socketHandler->getAddress(), _socketHandler->getPort()) ||
+						!socket.sendReceive(header, sizeof(header), content + request.PayloadHeader.offset, request.PayloadHeader.stripeSize,
+							reinterpret_cast<uint8_t*>(&ack), sizeof(ack)))
+					{
+						_concurrency.onFailure();
+						return;
+					}
+					Serializer::fromWire<ResponseMSGReceived>(reinterpret_cast<uint8_t*>(&ack));
+					acknowledged[i] = (ack.header.code == MessageDescriptor<ResponseMSGReceived>::code) &&
+						(ack.header.payloadSize == MessageDescriptor<ResponseMSGReceived>::payloadSize);
+					if (acknowledged[i])
+						_concurrency.onSuccess(sizeof(header) + request.PayloadHeader.stripeSize, Metrics::elapsedNanos(start));
+					else
+						_concurrency.onFailure();
+				}
+				catch (...)
+				{
+					acknowledged[i] = false;  // e.g. out of memory. Must not escape the thread.
+					_concurrency.onFailure();
+				}
+			});
+		}
+	}
+	catch (const std::system_error& error)
+	{
+		workers.clear();  // the stripes started are sent, the commit is not.
+		clearLastError();
+		_lastError << "Failed starting " << stripes << " stripe connections: " << error.what();
+		return false;
+	}
+	workers.clear();
 
-	const auto fileCRC = getCRC(textBeforeEnc);
+	const size_t failed = static_cast<size_t>(std::count(acknowledged.begin(), acknowledged.end(), false));
+	if (failed > 0)
+	{
+		clearLastError();
+		_lastError << failed << " of " << stripes << " stripes were not acknowledged by " << _socketHandler;
+		return false;
+	}
 
-	AESWrapper aes(_self.symmetricKey);
-	const std::string encrypted = aes.encrypt(file, bytes);
-	request.PayloadHeader.contentSize = encrypted.size();
+	RequestCommitStripedFile commit(_self.id);
+	commit.PayloadHeader.contentSize = source.contentSize;
+	commit.PayloadHeader.stripes = static_cast<csize_t>(stripes);
+	commit.PayloadHeader.file = source.file;
+	commit.header.payloadSize = sizeof(commit.PayloadHeader);
+	return transact(commit, response);
+}
 
-	uint8_t* content = nullptr;
-	content = new uint8_t[request.PayloadHeader.contentSize];
-	memcpy(content, encrypted.c_str(), request.PayloadHeader.contentSize);
-	delete[] file;
+/**
+ * Upload a file to every server. The file is read & CRCed once. Each server then gets the client's own registration
+ * & session key there (registered & exchanged once, see openSession), its own encryption of the shared plaintext,
+ * streamed in REPLICA_CHUNK_SIZE chunks, and its own CRC acknowledgement.
+ * Servers are served concurrently. A CRC mismatch is resent to that server only, up to MAX_FILE_RESEND_RETRIES times.
+ */
+bool ClientLogic::sendReplicated(const std::string& filePath)
+{
+	Tracer::Scope trace("ClientLogic::sendReplicated", "client");
+	RequestSendFile request(_self.id);
+	if (filePath.length() >= FILE_NAME_SIZE)
+	{
+		clearLastError();
+		_lastError << "Invalid file name length: " << filePath;
+		return false;
+	}
+	strcpy_s(reinterpret_cast<char*>(request.PayloadHeader.file.fileName), FILE_NAME_SIZE, filePath.c_str());
 
-	// prepare message to send
-	size_t msgSize;
-	uint8_t* msgToSend;
+	BufferPool::Buffer file;
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_READ);
+		if (!_fileHandler->readAtOnce(filePath, file))
+		{
+			clearLastError();
+			_lastError << "File not found!";
+			return false;
+		}
+		phase.addBytes(file.size());
+	}
+	uint32_t crc;
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_CRC, file.size());
+		crc = getCRC(file.data(), file.size());
+	}
+	request.PayloadHeader.contentSize = static_cast<csize_t>(AESWrapper::cipherSize(file.size()));
 	request.header.payloadSize = sizeof(request.PayloadHeader) + request.PayloadHeader.contentSize;
-	msgToSend = new uint8_t[sizeof(request) + request.PayloadHeader.contentSize];
-	memcpy(msgToSend, &request, sizeof(request));
-	memcpy(msgToSend + sizeof(request), content, request.PayloadHeader.contentSize);
-	msgSize = sizeof(request) + request.PayloadHeader.contentSize;
 
-	if (!_socketHandler->sendReceive(msgToSend, msgSize, reinterpret_cast<uint8_t* const>(&response), sizeof(response)))
+	struct Replica
+	{
+		ServerPool::Server server;
+		std::string        endpoint;
+		Session            session;
+		bool               validated = false;
+		std::string        error;
+	};
+	const size_t home = _sessionBound ? _sessionServer : _currentServer;  // holds _self's registration.
+	std::vector<Replica> replicas(_servers.size());
+	for (size_t i = 0; i < replicas.size(); ++i)
+	{
+		replicas[i].server = _servers.server(i);
+		replicas[i].endpoint = replicas[i].server.address + ':' + replicas[i].server.port;
+		if (i == home)
+		{
+			replicas[i].session = Session{ _self.id, _self.symmetricKey, _self.symmetricKeySet };
+			continue;
+		}
+		const auto it = _replicaSessions.find(replicas[i].endpoint);
+		if (it != _replicaSessions.end())
+			replicas[i].session = it->second;
+	}
+
+	std::vector<std::jthread> workers;  // joined when cleared.
+	workers.reserve(replicas.size());
+	try
+	{
+		for (auto& replica : replicas)
+		{
+			workers.emplace_back([&, request, crc]() mutable
+			{
+				SocketHandler socket;
+				socket.setCancellation(_cancellation);
+				if (!socket.setSocketInfo(replica.server.address, replica.server.port))
+				{
+					replica.error = "invalid address";
+					return;
+				}
+				if (!replica.session.keySet && !openSession(socket, replica.session, true, replica.error))
+					return;
+
+				const ClientID& id = replica.session.id;
+				request.header.clientId = id;
+				uint8_t header[sizeof(request)];
+				memcpy(header, &request, sizeof(request));
+				Serializer::toWire<RequestSendFile>(header);
+
+				for (size_t retries = MAX_FILE_RESEND_RETRIES; ; --retries)
+				{
+					ResponseFileAcception response;
+					size_t received = 0;
+					if (!sendEncrypted(socket, header, sizeof(header), file, replica.session.key) ||
+						!socket.receiveResponse(reinterpret_cast<uint8_t*>(&response), sizeof(response), received) ||
+						!checkResponse(response))
+					{
+						replica.error = "upload failed";
+						return;
+					}
+					ResponseMSGReceived ack;
+					if (response.PayloadHeader.crc == crc)
+					{
+						RequestValidCRC valid(id);
+						memcpy(valid.file.fileName, response.PayloadHeader.file.fileName, FILE_NAME_SIZE);
+						replica.validated = exchange(socket, valid, ack);
+						if (!replica.validated)
+							replica.error = "CRC acknowledgement failed";
+						return;
+					}
+					if (retries == 0)
+					{
+						(void)exchange(socket, RequestInvalidCRCAbort(id), ack);
+						replica.error = "CRC validation failed";
+						return;
+					}
+					uint8_t invalid[sizeof(RequestInvalidCRC)];
+					const RequestInvalidCRC invalidRequest(id);
+					memcpy(invalid, &invalidRequest, sizeof(invalid));
+					Serializer::toWire<RequestInvalidCRC>(invalid);
+					if (!socket.sendOnly(invalid, sizeof(invalid)))
+					{
+						replica.error = "upload failed";
+						return;
+					}
+				}
+			});
+		}
+	}
+	catch (const std::system_error& error)
+	{
+		for (size_t i = workers.size(); i < replicas.size(); ++i)
+			replicas[i].error = std::string("not started: ") + error.what();  // the others are still collected below.
+	}
+	workers.clear();
+
+	bool success = true;
+	clearLastError();
+	for (size_t i = 0; i < replicas.size(); ++i)
+	{
+		const auto& replica = replicas[i];
+		if (i == home)
+		{
+			_self.symmetricKey = replica.session.key;
+			_self.symmetricKeySet = replica.session.keySet;
+		}
+		else if (!(replica.session.id == ClientID()))
+		{
+			_replicaSessions[replica.endpoint] = replica.session;
+		}
+		if (!replica.validated)
+		{
+			_lastError << (success ? "" : ", ") << replica.endpoint << ": " << replica.error;
+			success = false;
+		}
+	}
+	storeSession();  // new registrations with replicas.
+	return success;
+}
+
+/**
+ * Send header followed by plain encrypted with key, REPLICA_CHUNK_SIZE bytes at a time, so a replica holds no
+ * ciphertext of the whole file. The request is zero padded to whole PACKET_SIZE packets like any other.
+ */
+bool ClientLogic::sendEncrypted(SocketHandler& socket, const uint8_t* const header, const size_t headerSize,
+	const BufferPool::Buffer& plain, const AESKey& key)
+{
+	if (!socket.isConnected() && !socket.connect())
+		return false;
+
+	AESWrapper::Encryptor encryptor(key);
+	BufferPool::Buffer cipher = BufferPool::instance().acquire(REPLICA_CHUNK_SIZE + AESWrapper::BLOCK_SIZE);
+	size_t offset = 0;
+	size_t sent = 0;
+	for (bool last = false; !last; )
+	{
+		last = (plain.size() - offset <= REPLICA_CHUNK_SIZE);
+		const std::span<const uint8_t> chunk(plain.data() + offset, last ? plain.size() - offset : REPLICA_CHUNK_SIZE);
+		size_t size;
+		{
+			Metrics::PhaseScope phase(Metrics::EPhase::PHASE_ENCRYPT, chunk.size());
+			const std::span<uint8_t> output(cipher.data(), cipher.size());
+			size = last ? encryptor.finish(chunk, output) : encryptor.update(chunk, output);
+		}
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, size);
+		if (size == 0 || !((sent == 0) ? socket.sendUnpadded(header, headerSize, cipher.data(), size) :
+			socket.sendUnpadded(cipher.data(), size, nullptr, 0)))
+			return false;
+		offset += chunk.size();
+		sent += size;
+	}
+
+	const size_t padding = (PACKET_SIZE - (headerSize + sent) % PACKET_SIZE) % PACKET_SIZE;
+	const uint8_t zeros[PACKET_SIZE] = { 0 };
+	return (padding == 0) || socket.sendUnpadded(zeros, padding, nullptr, 0);
+}
+
+/**
+ * Mirror the sync_directory tree to the server. The tree is scanned in parallel and files which are new or changed
+ * since the last sync (by size & last write time) are uploaded in sync_order. Uploaded files are recorded in SYNC_INFO,
+ * which is saved after every SYNC_BATCH_FILES files, so an interrupted sync resumes where it stopped.
+ * Empty files are skipped, as a file upload carries content.
+ */
+bool ClientLogic::syncDirectory()
+{
+	Tracer::Scope trace("ClientLogic::syncDirectory", "client");
+	Metrics::TransferScope transfer("syncDirectory");
+	if (_syncDirectory.empty())
 	{
-		delete[] content;
-		if (msgToSend != reinterpret_cast<uint8_t*>(&request))
-			delete[] msgToSend;
 		clearLastError();
-		_lastError << "Failed communicating with server on " << _socketHandler;
+		_lastError << "sync_directory is not set in " << OPTIONS_INFO;
 		return false;
 	}
 
-	delete[] content;
-	delete[] msgToSend;
+	DirectoryScanner scanner(_syncScanThreads, _syncOrder);
+	std::vector<DirectoryScanner::Entry> entries;
+	if (!scanner.scan(_syncDirectory, entries))
+	{
+		clearLastError();
+		_lastError << "Couldn't open directory " << _syncDirectory;
+		return false;
+	}
+	SyncManifest manifest;
+	if (!manifest.load(SYNC_INFO))
+	{
+		clearLastError();
+		_lastError << SYNC_INFO << " has an invalid line";
+		return false;
+	}
+	std::vector<DirectoryScanner::Entry> changed;
+	size_t empty = 0;
+	for (const auto& entry : entries)
+	{
+		if (entry.size == 0)
+			empty++;
+		else if (manifest.isChanged(entry.path, entry.size, entry.modified))
+			changed.push_back(entry);
+	}
 
-	// Validate ResponseFileAcception
-	if (!validateHeader(response.header, RESPONSE_SUCCESS_FILE_WITH_CRC))
-		return false;  // error message updated within.
+	bool success = true;
+	std::string error;   // of the first failed batch.
+	size_t count = 0;
+	for (size_t first = 0; first < changed.size(); first += SYNC_BATCH_FILES)
+	{
+		const size_t last = std::min(first + SYNC_BATCH_FILES, changed.size());
+		std::vector<std::string> filePaths;
+		for (size_t i = first; i < last; ++i)
+			filePaths.push_back(changed[i].path);
+		std::vector<bool> validated;
+		if (!sendBatch(filePaths, validated) && success)
+		{
+			success = false;
+			error = getLastError();
+		}
+		for (size_t i = first; i < last; ++i)
+		{
+			if (validated[i - first])
+				manifest.update(changed[i].path, changed[i].size, changed[i].modified);
+		}
+		count += static_cast<size_t>(std::count(validated.begin(), validated.end(), true));
+		if (!manifest.save())
+		{
+			success = false;
+			error = std::string("Couldn't write ") + SYNC_INFO;
+			break;
+		}
+	}
+	if (!success)
+	{
+		clearLastError();
+		_lastError << error << " (" << count << " of " << changed.size() << " changed files synced)";
+	}
+	else if (scanner.errors() > 0)
+		std::cout << scanner.errors() << " entries of " << _syncDirectory << " could not be read." << std::endl;
+	if (empty > 0)
+		std::cout << empty << " empty files of " << _syncDirectory << " were skipped." << std::endl;
+	_self.validCRC = success;
+	transfer.setSuccess(success);
+	return success;
+}
 
-	sent = true;
-	if (fileCRC == response.PayloadHeader.crc)
+/**
+ * Upload filePaths, small files packed when enabled and the others separately. validated is set per file.
+ */
+bool ClientLogic::sendBatch(const std::vector<std::string>& filePaths, std::vector<bool>& validated)
+{
+	validated.assign(filePaths.size(), false);
+	if (filePaths.empty())
+		return true;
+
+	std::vector<std::pair<size_t, size_t>> packable;   // index & size.
+	std::vector<size_t> others;
+	for (size_t i = 0; i < filePaths.size(); ++i)
 	{
-		informServerCRCValidated(response.PayloadHeader.file.fileName);
+		boost::system::error_code errorCode;
+		const auto size = isPacked() ? boost::filesystem::file_size(filePaths[i], errorCode) : 0;
+		if (isPacked() && !errorCode && size > 0 && size <= _packMaxFileSize && filePaths[i].length() < FILE_NAME_SIZE)
+			packable.emplace_back(i, static_cast<size_t>(size));
+		else
+			others.push_back(i);
 	}
-	else
+	if (packable.empty())
+		return sendSeparately(filePaths, validated);
+
+	bool success = sendPacked(filePaths, packable, validated);
+	if (others.empty())
+		return success;
+	std::vector<std::string> otherPaths;
+	otherPaths.reserve(others.size());
+	for (const size_t index : others)
+		otherPaths.push_back(filePaths[index]);
+	std::vector<bool> otherValidated;
+	success = sendSeparately(otherPaths, otherValidated) && success;
+	for (size_t i = 0; i < others.size(); ++i)
+		validated[others[i]] = otherValidated[i];
+	return success;
+}
+
+/**
+ * Upload filePaths pipelined or multiplexed when enabled, otherwise one at a time with the same CRC retries as the
+ * menu's single file upload. validated is set per file.
+ */
+bool ClientLogic::sendSeparately(const std::vector<std::string>& filePaths, std::vector<bool>& validated)
+{
+	validated.assign(filePaths.size(), false);
+	if (isPipelined() || isMultiplexed())
+	{
+		const CancellationToken::DeadlineScope deadline(*_cancellation, _transferTimeout);
+		return isMultiplexed() ? sendMultiplexed(filePaths, validated) : sendPipelined(filePaths, validated);
+	}
+
+	bool success = true;
+	for (size_t i = 0; i < filePaths.size() && !_stopRequested.load(); ++i)
+	{
+		const CancellationToken::DeadlineScope deadline(*_cancellation, _transferTimeout);  // clears a timeout's cancellation.
+		bool sent = false;
+		validated[i] = uploadFile(filePaths[i], sent);
+		for (size_t retries = MAX_FILE_RESEND_RETRIES; !validated[i] && sent && !_self.validCRC; --retries)
+		{
+			informServerCRCFailed(retries);
+			if (retries == 0)
+				break;
+			validated[i] = uploadFile(filePaths[i], sent);
+		}
+		success = success && validated[i];
+	}
+	return success;
+}
+
+/**
+ * Upload small files packed into RequestSendPackedFiles containers of up to _packMaxBytes plain bytes and
+ * MAX_PACKED_FILES files each. The server validates a whole container against its index and acknowledges it by a
+ * single response, which flags the mismatched files. Only those are packed & sent again, as the server stored the
+ * others already, up to MAX_FILE_RESEND_RETRIES times.
+ * files holds the index into filePaths & the listed size of each file to pack.
+ */
+bool ClientLogic::sendPacked(const std::vector<std::string>& filePaths, const std::vector<std::pair<size_t, size_t>>& files, std::vector<bool>& validated)
+{
+	Tracer::Scope trace("ClientLogic::sendPacked", "client");
+	bool success = true;
+	for (size_t first = 0; first < files.size();)
+	{
+		size_t last = first;
+		size_t capacity = 0;
+		while (last < files.size() && last - first < MAX_PACKED_FILES)
+		{
+			const size_t entrySize = files[last].second + sizeof(PackedFileEntry) + filePaths[files[last].first].length();
+			if (last > first && capacity + entrySize > _packMaxBytes)
+				break;
+			capacity += entrySize;
+			++last;
+		}
+		std::vector<std::pair<size_t, size_t>> pending(files.begin() + first, files.begin() + last);
+		first = last;
+
+		const CancellationToken::DeadlineScope deadline(*_cancellation, _transferTimeout);
+		for (size_t retries = MAX_FILE_RESEND_RETRIES; ; --retries)
+		{
+			BufferPool::Buffer message;
+			std::vector<std::pair<size_t, size_t>> packed;
+			if (!packFiles(filePaths, pending, message, packed))
+			{
+				success = false;  // error message updated within.
+				if (packed.empty())
+					break;
+			}
+			ResponsePackedFilesReceived response;
+			if (!transact<RequestSendPackedFiles>(message.data(), message.size(), response))
+			{
+				success = false;  // error message updated within.
+				break;
+			}
+			if (response.PayloadHeader.files != packed.size())
+			{
+				success = false;  // a resend could store files twice.
+				clearLastError();
+				_lastError << "Server acknowledged " << response.PayloadHeader.files << " of " << packed.size() << " packed files.";
+				break;
+			}
+
+			pending.clear();
+			for (size_t i = 0; i < packed.size(); ++i)
+			{
+				if (response.PayloadHeader.mismatched[i / 8] & (1 << (i % 8)))
+					pending.push_back(packed[i]);
+				else
+					validated[packed[i].first] = true;
+			}
+			if (pending.empty())
+				break;
+			clearLastError();
+			_lastError << "CRC validation with server has failed for " << pending.size() << " of " << packed.size() << " packed files.";
+			if (retries == 0)
+			{
+				success = false;
+				break;
+			}
+		}
+	}
+	return success;
+}
+
+/**
+ * Read files straight into a container one after another, index them behind their data with a CRC each,
+ * and encrypt the container into a RequestSendPackedFiles message. packed lists the files packed, in index order.
+ * Return false if any file could not be read; the others are packed nonetheless.
+ */
+bool ClientLogic::packFiles(const std::vector<std::string>& filePaths, const std::vector<std::pair<size_t, size_t>>& files,
+	BufferPool::Buffer& message, std::vector<std::pair<size_t, size_t>>& packed)
+{
+	size_t capacity = 0;
+	for (const auto& [index, size] : files)
+		capacity += size + sizeof(PackedFileEntry) + filePaths[index].length();
+	BufferPool::Buffer container = BufferPool::instance().acquire(capacity);
+	std::vector<PackedFileEntry> entries;
+	bool success = true;
+	size_t offset = 0;
+	for (const auto& [index, size] : files)
+	{
+		bool read;
+		{
+			Metrics::PhaseScope phase(Metrics::EPhase::PHASE_READ);
+			read = _fileHandler->openSequential(filePaths[index]) && _fileHandler->size() == size &&
+				_fileHandler->read(container.data() + offset, size);
+			_fileHandler->close();
+			if (read)
+				phase.addBytes(size);
+		}
+		if (!read)
+		{
+			clearLastError();
+			_lastError << "File not found or changed: " << filePaths[index];
+			success = false;
+			continue;
+		}
+
+		PackedFileEntry entry;
+		entry.offset = static_cast<csize_t>(offset);
+		entry.size = static_cast<csize_t>(size);
+		entry.nameSize = static_cast<uint16_t>(filePaths[index].length());
+		{
+			Metrics::PhaseScope phase(Metrics::EPhase::PHASE_CRC, size);
+			entry.crc = getCRC(container.data() + offset, size);
+		}
+		entries.push_back(entry);
+		packed.emplace_back(index, size);
+		offset += size;
+	}
+	if (packed.empty())
+		return false;
+
+	uint8_t* position = container.data() + offset;
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_ASSEMBLE);
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			memcpy(position, &entries[i], sizeof(PackedFileEntry));
+			Serializer::toWire<PackedFileEntry>(position);
+			position += sizeof(PackedFileEntry);
+			memcpy(position, filePaths[packed[i].first].data(), entries[i].nameSize);
+			position += entries[i].nameSize;
+		}
+		phase.addBytes(position - (container.data() + offset));
+	}
+	const size_t plainSize = position - container.data();
+
+	RequestSendPackedFiles request(_self.id);
+	request.PayloadHeader.files = static_cast<csize_t>(packed.size());
+	request.PayloadHeader.indexSize = static_cast<csize_t>(plainSize - offset);
+	request.PayloadHeader.contentSize = static_cast<csize_t>(AESWrapper::cipherSize(plainSize));
+	request.header.payloadSize = sizeof(request.PayloadHeader) + request.PayloadHeader.contentSize;
+	message = BufferPool::instance().acquire(sizeof(request) + request.PayloadHeader.contentSize);
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_ENCRYPT, plainSize);
+		AESWrapper aes(_self.symmetricKey);
+		(void)aes.encrypt(std::span<const uint8_t>(container.data(), plainSize),
+			std::span<uint8_t>(message.data() + sizeof(request), request.PayloadHeader.contentSize));
+	}
+	container.release();
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_ASSEMBLE, sizeof(request));
+		memcpy(message.data(), &request, sizeof(request));
+		Serializer::toWire<RequestSendPackedFiles>(message.data());  // cipher text bytes are sent as is.
+	}
+	return success;
+}
+
+/**
+ * Upload files as they land in the watch_directory tree, in debounced batches, until cancel() is called.
+ * A failed file is batched again after a backoff doubling from the debounce time, up to MAX_WATCH_RETRIES times.
+ * While the server is unreachable, a failed batch is held back without counting against its files, backing off up to
+ * ServerPool::MAX_BACKOFF until the server accepts connections again.
+ * Return false if the directory cannot be watched.
+ */
+bool ClientLogic::watchDirectory()
+{
+	Tracer::Scope trace("ClientLogic::watchDirectory", "client");
+	if (_watchDirectory.empty())
 	{
-		_self.validCRC = false;
 		clearLastError();
-		_lastError << "CRC validation with server has failed.";
+		_lastError << "watch_directory is not set in " << OPTIONS_INFO;
 		return false;
 	}
+	const auto watcher = std::make_shared<FolderWatcher>(_watchDebounce, _watchMaxDelay, _watchMaxBatch);
+	if (!watcher->open(_watchDirectory))
+	{
+		clearLastError();
+		_lastError << "Couldn't watch directory " << _watchDirectory << " (requires Linux inotify)";
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_watcherMutex);
+		_watcher = watcher;
+	}
+
+	std::cout << "Watching " << _watchDirectory << " for new files." << std::endl;
+	_stopRequested.store(false);
+	std::vector<std::string> filePaths;
+	std::chrono::steady_clock::time_point landed;
+	std::map<std::string, size_t> failures;   // failed uploads per file.
+	size_t outages = 0;                       // batches held back in a row as the server was unreachable.
+	while (watcher->nextBatch(filePaths, landed))
+	{
+		Metrics::TransferScope transfer("watchDirectory");
+		std::vector<bool> validated;
+		const bool success = sendBatch(filePaths, validated);
+		transfer.setSuccess(success);
+		const auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - landed);
+		std::cout << std::count(validated.begin(), validated.end(), true) << " of " << filePaths.size()
+			<< " files uploaded " << latency.count() << "ms after landing." << (success ? "" : " " + getLastError()) << std::endl;
+
+		// Failed files are batched again, unless gone or empty meanwhile, up to MAX_WATCH_RETRIES times.
+		const bool held = !success && std::find(validated.begin(), validated.end(), true) == validated.end() &&
+			!watcher->isStopped() && !serverReachable();
+		outages = held ? (outages + 1) : 0;
+		std::chrono::milliseconds outageDelay{ 0 };
+		if (held)
+		{
+			outageDelay = std::max(std::chrono::duration_cast<std::chrono::milliseconds>(_servers.timeUntilHealthy()), std::min<std::chrono::milliseconds>(
+				_watchDebounce * (static_cast<int64_t>(1) << std::min<size_t>(outages, 16)), ServerPool::MAX_BACKOFF));
+			std::cout << "Server unreachable, holding " << filePaths.size() << " files back for " << outageDelay.count() << "ms." << std::endl;
+		}
+		for (size_t i = 0; i < filePaths.size() && !watcher->isStopped(); ++i)
+		{
+			if (validated[i])
+			{
+				failures.erase(filePaths[i]);
+				continue;
+			}
+			boost::system::error_code errorCode;
+			const auto size = boost::filesystem::file_size(filePaths[i], errorCode);
+			if (errorCode || size == 0)
+				failures.erase(filePaths[i]);
+			else if (held)
+				watcher->requeue(filePaths[i], outageDelay);
+			else if (++failures[filePaths[i]] <= MAX_WATCH_RETRIES)
+				watcher->requeue(filePaths[i], _watchDebounce * (static_cast<int64_t>(1) << failures[filePaths[i]]));
+			else
+			{
+				std::cout << "Gave up uploading " << filePaths[i] << " after " << MAX_WATCH_RETRIES << " retries." << std::endl;
+				failures.erase(filePaths[i]);
+			}
+		}
+	}
 
+	{
+		std::lock_guard<std::mutex> lock(_watcherMutex);
+		_watcher.reset();
+	}
+	_stopRequested.store(false);
+	_cancellation->reset(std::chrono::steady_clock::time_point::max());  // a stop must not fail following requests.
+	if (!watcher->isStopped())
+	{
+		clearLastError();
+		_lastError << "Failed watching directory " << _watchDirectory;
+		return false;
+	}
 	return true;
 }
@@ -7,9 +7,25 @@
 
 #include "pch.h"
 #include "ClientMenu.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <iostream>
+#include <thread>
 #include <boost/algorithm/string/trim.hpp>
 
+namespace
+{
+	constexpr std::chrono::milliseconds INTERRUPT_POLL_INTERVAL{ 100 };
+	std::atomic<bool> interrupted(false);
+
+	// Only sets a flag: a signal handler may not take the locks ClientLogic::cancel() takes.
+	void onInterrupt(int)
+	{
+		interrupted.store(true);
+	}
+}
+
  /**
   * Print error and exit client.
   */
@@ -29,6 +45,10 @@ void ClientMenu::initialize()
 	{
 		clientStop(_clientLogic.getLastError());
 	}
+	if (!_clientLogic.parseOptionsInfo())
+	{
+		clientStop(_clientLogic.getLastError());
+	}
 	_registered = _clientLogic.parseRegisteredClientInfo();
 	_rsaGenerated = _clientLogic.isRSAGenerated();
 }
@@ -172,6 +192,12 @@ void ClientMenu::handleUserChoice()
 				return;
 			}
 
+			if (_clientLogic.isPipelined() || _clientLogic.isMultiplexed() || _clientLogic.isPacked())
+			{
+				success = _clientLogic.sendFiles();   // all listed files, with retries, on a single connection.
+				break;
+			}
+
 			size_t counter = MAX_FILE_RESEND_RETRIES;
 			bool sent = false;
 			success = _clientLogic.sendFile(sent);
@@ -188,7 +214,57 @@ void ClientMenu::handleUserChoice()
 			}
 			break;
 		}
+		case MenuOption::EOption::MENU_SYNC_DIRECTORY:
+		{
+			if (!_clientLogic.isSymmetricKeySet())
+			{
+				std::cout << _clientLogic.getSelfUsername() << ", you didn't get a Symmetric key from the server yet!\
+					\nPlease send your public key to the server in order to get a Symmetric key from the server." << std::endl;
+				return;
+			}
+			success = _clientLogic.syncDirectory();   // new & changed files, with retries.
+			break;
+		}
+		case MenuOption::EOption::MENU_WATCH_DIRECTORY:
+		{
+			if (!_clientLogic.isSymmetricKeySet())
+			{
+				std::cout << _clientLogic.getSelfUsername() << ", you didn't get a Symmetric key from the server yet!\
+					\nPlease send your public key to the server in order to get a Symmetric key from the server." << std::endl;
+				return;
+			}
+			success = watchUntilInterrupted();
+			break;
+		}
 	}
 
 	std::cout << (success ? menuOption.getSuccessString() : _clientLogic.getLastError()) << std::endl;
 }
+
+/**
+ * Run the directory watch until Ctrl+C, which cancels it through ClientLogic::cancel() from a helper thread.
+ */
+bool ClientMenu::watchUntilInterrupted()
+{
+	std::cout << "Press Ctrl+C to stop watching." << std::endl;
+	interrupted.store(false);
+	std::atomic<bool> watching(true);
+	std::thread stopper([this, &watching]()
+	{
+		while (watching.load())
+		{
+			if (interrupted.exchange(false))
+			{
+				_clientLogic.cancel();
+				return;
+			}
+			std::this_thread::sleep_for(INTERRUPT_POLL_INTERVAL);
+		}
+	});
+	const auto previous = std::signal(SIGINT, onInterrupt);
+	const bool success = _clientLogic.watchDirectory();
+	std::signal(SIGINT, (previous == SIG_ERR) ? SIG_DFL : previous);
+	watching.store(false);
+	stopper.join();
+	return success;
+}
@@ -0,0 +1,130 @@
+/**
+ * Encrypted File Transfer Client
+ * @file ConcurrencyController.cpp
+ * @brief Adaptive limit of concurrent transfers (files in flight, streams or stripes) using AIMD.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "ConcurrencyController.h"
+#include "Metrics.h"
+#include <algorithm>
+
+ConcurrencyController::ConcurrencyController() : _enabled(false), _window(INITIAL_WINDOW), _maximum(MAX_WINDOW), _baseline(0), _lastGoodput(0),
+	_roundBytes(0), _roundCompletions(0), _roundDecreased(false), _roundStart(std::chrono::steady_clock::now())
+{
+}
+
+void ConcurrencyController::enable(const bool enabled)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_enabled = enabled;
+	publish();
+}
+
+bool ConcurrencyController::isEnabled() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _enabled;
+}
+
+size_t ConcurrencyController::window() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _window;
+}
+
+/**
+ * Concurrency to use given a configured maximum. The configured value as is while disabled.
+ * The window is clamped to the maximum, so it neither grows past it nor has to shrink back from above it.
+ */
+size_t ConcurrencyController::limit(const size_t configured)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_enabled)
+		return configured;
+	_maximum = std::clamp(configured, MIN_WINDOW, MAX_WINDOW);
+	if (_window > _maximum)
+	{
+		_window = _maximum;
+		publish();
+	}
+	return _window;
+}
+
+/**
+ * Account a completed transfer of bytes. Halve the window on a latency spike.
+ * Once a round completes, grow the window if goodput held.
+ */
+void ConcurrencyController::onSuccess(const uint64_t bytes, const uint64_t latencyNanos)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_enabled)
+		return;
+
+	const double cost = static_cast<double>(latencyNanos) / static_cast<double>(std::max(bytes, MIN_LATENCY_BYTES));
+	if (_baseline > 0 && cost > LATENCY_SPIKE_FACTOR * _baseline)
+	{
+		decrease();
+		_baseline += SPIKE_BASELINE_GAIN * (cost - _baseline);
+	}
+	else
+	{
+		_baseline = (_baseline > 0) ? (0.875 * _baseline + 0.125 * cost) : cost;
+	}
+	_roundBytes += bytes;
+	complete();
+}
+
+/**
+ * Error response or connection failure.
+ */
+void ConcurrencyController::onFailure()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_enabled)
+		return;
+	decrease();
+	complete();
+}
+
+/**
+ * Multiplicative decrease, once per round. Caller must hold _mutex.
+ */
+void ConcurrencyController::decrease()
+{
+	if (_roundDecreased)
+		return;
+	_window = std::max(MIN_WINDOW, static_cast<size_t>(static_cast<double>(_window) * DECREASE_FACTOR));
+	_roundDecreased = true;
+	publish();
+}
+
+/**
+ * Count a completion toward the round. Once window completions are counted, grow the window unless it was decreased
+ * during the round or goodput dropped, and start the next round. Caller must hold _mutex.
+ */
+void ConcurrencyController::complete()
+{
+	if (++_roundCompletions < _window)
+		return;
+
+	const double seconds = static_cast<double>(Metrics::elapsedNanos(_roundStart)) / 1e9;
+	const double goodput = (seconds > 0) ? (static_cast<double>(_roundBytes) / seconds) : 0;
+	if (!_roundDecreased && goodput >= GOODPUT_TOLERANCE * _lastGoodput)
+		_window = std::min(_window + 1, _maximum);
+	_lastGoodput = goodput;
+	_roundBytes = 0;
+	_roundCompletions = 0;
+	_roundDecreased = false;
+	_roundStart = std::chrono::steady_clock::now();
+	publish();
+}
+
+/**
+ * Caller must hold _mutex.
+ */
+void ConcurrencyController::publish() const
+{
+	Metrics::instance().setConcurrencyWindow(_enabled ? _window : 0);
+}
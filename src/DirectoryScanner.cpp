@@ -0,0 +1,256 @@
+/**
+ * Encrypted File Transfer Client
+ * @file DirectoryScanner.cpp
+ * @brief Parallel scan of a directory tree for regular files.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "DirectoryScanner.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <boost/filesystem.hpp>
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+DirectoryScanner::DirectoryScanner(const size_t threads, const EOrder order) : _threads(std::max<size_t>(threads, 1)),
+	_order(order), _pending(0), _events(0), _errors(0)
+{
+}
+
+/**
+ * Accept path, inode & extent.
+ */
+bool DirectoryScanner::parseOrder(const std::string& name, EOrder& order)
+{
+	if (name == "path")
+		order = EOrder::ORDER_PATH;
+	else if (name == "inode")
+		order = EOrder::ORDER_INODE;
+	else if (name == "extent")
+		order = EOrder::ORDER_EXTENT;
+	else
+		return false;
+	return true;
+}
+
+/**
+ * Collect all regular files under root, ordered by the scanner's order. Return false if root is not a directory.
+ * Entries which cannot be read are skipped and counted by errors().
+ */
+bool DirectoryScanner::scan(const std::string& root, std::vector<Entry>& entries)
+{
+	Tracer::Scope trace("DirectoryScanner::scan", "io");
+	entries.clear();
+	boost::system::error_code errorCode;
+	if (!boost::filesystem::is_directory(root, errorCode))
+		return false;
+
+	_workers.clear();
+	for (size_t i = 0; i < _threads; ++i)
+		_workers.push_back(std::make_unique<Worker>());
+	_errors.store(0, std::memory_order_relaxed);
+	_pending.store(1, std::memory_order_relaxed);
+	_workers[0]->directories.push_back(root);
+
+	std::vector<std::jthread> threads;
+	try
+	{
+		for (size_t i = 1; i < _threads; ++i)
+			threads.emplace_back(&DirectoryScanner::work, this, i);
+	}
+	catch (const std::system_error&)
+	{
+		// Scan on the threads started. Only a worker's own thread queues directories on its deque.
+	}
+	work(0);
+	threads.clear();  // join.
+
+	size_t count = 0;
+	for (const auto& worker : _workers)
+		count += worker->entries.size();
+	entries.reserve(count);
+	for (const auto& worker : _workers)
+		std::move(worker->entries.begin(), worker->entries.end(), std::back_inserter(entries));
+	_workers.clear();
+
+	switch (_order)
+	{
+	case EOrder::ORDER_EXTENT:
+		std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+			{ return std::tie(lhs.extent, lhs.inode, lhs.path) < std::tie(rhs.extent, rhs.inode, rhs.path); });
+		break;
+	case EOrder::ORDER_INODE:
+		std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+			{ return std::tie(lhs.inode, lhs.path) < std::tie(rhs.inode, rhs.path); });
+		break;
+	case EOrder::ORDER_PATH:
+	default:
+		std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) { return lhs.path < rhs.path; });
+		break;
+	}
+	return true;
+}
+
+/**
+ * Scan directories until none is queued or being scanned by any thread.
+ * A directory stays pending while it is scanned, so the count cannot reach zero while subdirectories may follow.
+ */
+void DirectoryScanner::work(const size_t index)
+{
+	std::string directory;
+	for (;;)
+	{
+		const uint32_t events = _events.load(std::memory_order_acquire);
+		if (take(index, directory))
+		{
+			scanDirectory(*_workers[index], directory);
+			if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				signal();  // the last one. Wake idle threads to return.
+			continue;
+		}
+		if (_pending.load(std::memory_order_acquire) == 0)
+			return;
+		_events.wait(events, std::memory_order_acquire);
+	}
+}
+
+/**
+ * Pop the newest directory of this thread, or else steal the oldest directory of another one.
+ */
+bool DirectoryScanner::take(const size_t index, std::string& directory)
+{
+	{
+		Worker& own = *_workers[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.directories.empty())
+		{
+			directory = std::move(own.directories.back());
+			own.directories.pop_back();
+			return true;
+		}
+	}
+	for (size_t i = 1; i < _workers.size(); ++i)
+	{
+		Worker& victim = *_workers[(index + i) % _workers.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.directories.empty())
+		{
+			directory = std::move(victim.directories.front());
+			victim.directories.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * List a directory: collect its regular files and queue its subdirectories on worker's deque.
+ */
+void DirectoryScanner::scanDirectory(Worker& worker, const std::string& directory)
+{
+	boost::system::error_code errorCode;
+	boost::filesystem::directory_iterator it(directory, errorCode);
+	const boost::filesystem::directory_iterator end;
+	std::vector<std::string> subdirectories;
+	for (; !errorCode && it != end; it.increment(errorCode))
+	{
+		Entry entry;
+		entry.path = it->path().string();
+#ifdef __linux__
+		struct stat status;
+		if (::lstat(entry.path.c_str(), &status) != 0)
+		{
+			_errors.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		if (S_ISDIR(status.st_mode))
+		{
+			subdirectories.push_back(std::move(entry.path));
+			continue;
+		}
+		if (!S_ISREG(status.st_mode))
+			continue;
+		entry.size = static_cast<uint64_t>(status.st_size);
+		entry.modified = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+		entry.inode = static_cast<uint64_t>(status.st_ino);
+#else
+		boost::system::error_code entryError;
+		const auto status = it->symlink_status(entryError);
+		if (entryError)
+		{
+			_errors.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		if (boost::filesystem::is_directory(status))
+		{
+			subdirectories.push_back(std::move(entry.path));
+			continue;
+		}
+		if (!boost::filesystem::is_regular_file(status))
+			continue;
+		entry.size = static_cast<uint64_t>(boost::filesystem::file_size(it->path(), entryError));
+		entry.modified = static_cast<int64_t>(boost::filesystem::last_write_time(it->path(), entryError)) * 1000000000;
+		if (entryError)
+		{
+			_errors.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+#endif
+		if (_order == EOrder::ORDER_EXTENT)
+			entry.extent = firstExtent(entry.path);
+		worker.entries.push_back(std::move(entry));
+	}
+	if (errorCode)
+		_errors.fetch_add(1, std::memory_order_relaxed);
+
+	if (subdirectories.empty())
+		return;
+	_pending.fetch_add(subdirectories.size(), std::memory_order_acq_rel);
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		for (auto& subdirectory : subdirectories)
+			worker.directories.push_back(std::move(subdirectory));
+	}
+	signal();
+}
+
+void DirectoryScanner::signal()
+{
+	_events.fetch_add(1, std::memory_order_release);
+	_events.notify_all();
+}
+
+/**
+ * Physical offset of a file's first extent, by FIEMAP. 0 if unknown, e.g. empty files or unsupported filesystems.
+ */
+uint64_t DirectoryScanner::firstExtent(const std::string& path)
+{
+#ifdef __linux__
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	alignas(fiemap) uint8_t buffer[sizeof(fiemap) + sizeof(fiemap_extent)] = { 0 };
+	auto* const map = reinterpret_cast<fiemap*>(buffer);
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+	uint64_t result = 0;
+	if (::ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0)
+		result = map->fm_extents[0].fe_physical;
+	(void)::close(fd);
+	return result;
+#else
+	(void)path;
+	return 0;
+#endif
+}
@@ -0,0 +1,114 @@
+/**
+ * Encrypted File Transfer Client
+ * @file EndpointResolver.cpp
+ * @brief Process-wide io_context & cache of resolved server endpoints.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "EndpointResolver.h"
+#include "Tracer.h"
+
+using boost::asio::ip::tcp;
+
+EndpointResolver& EndpointResolver::instance()
+{
+	static EndpointResolver resolver;
+	return resolver;
+}
+
+EndpointResolver::EndpointResolver() : _work(boost::asio::make_work_guard(_context)), _resolver(_context),
+	_ttl(DEFAULT_TTL), _negativeTTL(DEFAULT_NEGATIVE_TTL)
+{
+	_thread = std::thread([this]() { _context.run(); });
+}
+
+EndpointResolver::~EndpointResolver()
+{
+	_work.reset();
+	_context.stop();
+	if (_thread.joinable())
+		_thread.join();
+}
+
+void EndpointResolver::setTTL(const std::chrono::seconds ttl, const std::chrono::seconds negativeTTL)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_ttl = ttl;
+	_negativeTTL = negativeTTL;
+}
+
+/**
+ * Drop all cached results. Lookups in progress complete normally.
+ */
+void EndpointResolver::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto it = _cache.begin(); it != _cache.end();)
+		it = it->second.resolving ? std::next(it) : _cache.erase(it);
+}
+
+/**
+ * Start resolving host:port in the background, unless a fresh result is cached or a lookup is in progress.
+ */
+void EndpointResolver::prefetch(const std::string& host, const std::string& port)
+{
+	const std::string key = host + ':' + port;
+	std::lock_guard<std::mutex> lock(_mutex);
+	const Entry& entry = _cache[key];
+	if (!entry.resolving && (!entry.resolved || std::chrono::steady_clock::now() >= entry.expires))
+		startResolve(key, host, port);
+}
+
+/**
+ * Return cached endpoints of host:port. Expired endpoints are returned as is and refreshed in the background.
+ * Waits for the resolver only if nothing usable is cached. Return false if resolution failed.
+ */
+bool EndpointResolver::resolve(const std::string& host, const std::string& port, Endpoints& endpoints)
+{
+	Tracer::Scope trace("EndpointResolver::resolve", "net");
+	const std::string key = host + ':' + port;
+	std::unique_lock<std::mutex> lock(_mutex);
+	Entry& entry = _cache[key];  // std::map references stay valid.
+	const bool fresh = entry.resolved && std::chrono::steady_clock::now() < entry.expires;
+	if (!fresh && !entry.resolving)
+		startResolve(key, host, port);
+
+	if (!fresh && (!entry.resolved || entry.failed))
+		_resolved.wait(lock, [&entry]() { return !entry.resolving; });
+
+	if (entry.failed)
+		return false;
+	endpoints = entry.endpoints;
+	return true;
+}
+
+void EndpointResolver::startResolve(const std::string& key, const std::string& host, const std::string& port)
+{
+	_cache[key].resolving = true;
+	_resolver.async_resolve(host, port, tcp::resolver::canonical_name,
+		[this, key](const boost::system::error_code& errorCode, const Endpoints& results)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			Entry& entry = _cache[key];
+			const auto now = std::chrono::steady_clock::now();
+			entry.resolving = false;
+			if (!errorCode && !results.empty())
+			{
+				entry.endpoints = results;
+				entry.failed = false;
+				entry.expires = now + _ttl;
+			}
+			else if (entry.resolved && !entry.failed)
+			{
+				entry.expires = now + _negativeTTL;  // keep serving the last good result, retry later.
+			}
+			else
+			{
+				entry.failed = true;
+				entry.expires = now + _negativeTTL;
+			}
+			entry.resolved = true;
+			_resolved.notify_all();
+		});
+}
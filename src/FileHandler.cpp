@@ -7,12 +7,23 @@
 
 #include "pch.h"
 #include "FileHandler.h"
+#include "Metrics.h"
+#include "Tracer.h"
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <boost/filesystem.hpp>  // for create_directories
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+std::atomic<FileHandler::ECacheMode> FileHandler::_cacheMode{ ECacheMode::CACHE_DEFAULT };
 
-FileHandler::FileHandler() : _fileStream(nullptr), _open(false)
+FileHandler::FileHandler() : _fileStream(nullptr), _open(false), _descriptor(-1), _offset(0), _dropped(0),
+	_direct(false), _dropBehind(false)
 {
 }
 
@@ -52,6 +63,52 @@ bool FileHandler::open(const std::string& filepath, bool write)
 }
 
 
+/**
+ * Open a file for sequential reading. On Linux, read through a descriptor with a sequential readahead hint, and
+ * bypass or drop behind the page cache by cache mode. O_DIRECT is not supported by every filesystem (e.g. tmpfs),
+ * which falls back to drop behind. Elsewhere, same as open(filepath).
+ */
+bool FileHandler::openSequential(const std::string& filepath)
+{
+#ifdef __linux__
+	if (filepath.empty())
+		return false;
+	close();
+	const ECacheMode mode = cacheMode();
+	if (mode == ECacheMode::CACHE_DIRECT)
+		_descriptor = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+	_direct = (_descriptor >= 0);
+	if (_descriptor < 0)
+		_descriptor = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (_descriptor < 0)
+		return false;
+	_dropBehind = !_direct && (mode != ECacheMode::CACHE_DEFAULT);
+	(void)posix_fadvise(_descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);  // larger readahead window.
+	_offset = 0;
+	_dropped = 0;
+	_open = true;
+	return true;
+#else
+	return open(filepath);
+#endif
+}
+
+/**
+ * Accept default, drop_behind & direct.
+ */
+bool FileHandler::parseCacheMode(const std::string& name, ECacheMode& mode)
+{
+	if (name == "default")
+		mode = ECacheMode::CACHE_DEFAULT;
+	else if (name == "drop_behind")
+		mode = ECacheMode::CACHE_DROP_BEHIND;
+	else if (name == "direct")
+		mode = ECacheMode::CACHE_DIRECT;
+	else
+		return false;
+	return true;
+}
+
 /**
  * Open a file for write (append). Create folders in filepath if do not exist.
  * Relative paths not supported!
@@ -86,6 +143,20 @@ bool FileHandler::openToAppend(const std::string& filepath)
  */
 void FileHandler::close()
 {
+#ifdef __linux__
+	if (_descriptor >= 0)
+	{
+		if (_dropBehind)
+		{
+			(void)posix_fadvise(_descriptor, static_cast<off_t>(_dropped), 0, POSIX_FADV_DONTNEED);  // the rest, incl. readahead.
+			Metrics::instance().recordCacheDropped(_offset > _dropped ? _offset - _dropped : 0);
+		}
+		(void)::close(_descriptor);
+	}
+#endif
+	_descriptor = -1;
+	_direct = false;
+	_dropBehind = false;
 	try
 	{
 		if (_fileStream != nullptr)
@@ -105,11 +176,15 @@ void FileHandler::close()
  */
 bool FileHandler::read(uint8_t* const dest, const size_t bytes) const
 {
+	Tracer::Scope trace("FileHandler::read", "io");
+	if (_descriptor >= 0)
+		return readDescriptor(dest, bytes);
 	if (_fileStream == nullptr || !_open || dest == nullptr || bytes == 0)
 		return false;
 	try
 	{
 		_fileStream->read(reinterpret_cast<char*>(dest), bytes);
+		Metrics::instance().recordFileRead(bytes, false);
 		return true;
 	}
 	catch (...)
@@ -118,11 +193,91 @@ bool FileHandler::read(uint8_t* const dest, const size_t bytes) const
 	}
 }
 
+/**
+ * Read exactly bytes at the descriptor's position. Direct reads need an aligned dest & position: the aligned body is
+ * read into dest, a shorter tail through an aligned block. Otherwise reads continue without O_DIRECT.
+ */
+bool FileHandler::readDescriptor(uint8_t* const dest, const size_t bytes) const
+{
+#ifdef __linux__
+	if (dest == nullptr || bytes == 0)
+		return false;
+	if (_direct && (reinterpret_cast<uintptr_t>(dest) % DIRECT_ALIGNMENT != 0 || _offset % DIRECT_ALIGNMENT != 0))
+		disableDirect();
+	const size_t body = _direct ? (bytes / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT) : bytes;
+	for (size_t done = 0; done < body;)
+	{
+		const ssize_t result = ::pread(_descriptor, dest + done, body - done, static_cast<off_t>(_offset + done));
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return false;  // error, or end of file before bytes.
+		done += static_cast<size_t>(result);
+		if (_direct && done % DIRECT_ALIGNMENT != 0)
+			disableDirect();  // the rest would start unaligned, which O_DIRECT rejects.
+	}
+	if (body < bytes)
+	{
+		// Read the whole block the tail lies in. It ends at the end of file, so the read is short.
+		alignas(DIRECT_ALIGNMENT) uint8_t block[DIRECT_ALIGNMENT];
+		ssize_t result;
+		do
+		{
+			result = ::pread(_descriptor, block, DIRECT_ALIGNMENT, static_cast<off_t>(_offset + body));
+		} while (result < 0 && errno == EINTR);
+		if (result < static_cast<ssize_t>(bytes - body))
+			return false;
+		std::memcpy(dest + body, block, bytes - body);
+	}
+	_offset += bytes;
+	Metrics::instance().recordFileRead(bytes, _direct);
+	dropBehind(_offset);
+	return true;
+#else
+	(void)dest; (void)bytes;
+	return false;
+#endif
+}
+
+/**
+ * Continue reading through the page cache, e.g. into a buffer O_DIRECT cannot use. Read pages are then dropped behind.
+ */
+void FileHandler::disableDirect() const
+{
+#ifdef __linux__
+	const int flags = ::fcntl(_descriptor, F_GETFL);
+	if (flags >= 0)
+		(void)::fcntl(_descriptor, F_SETFL, flags & ~O_DIRECT);
+#endif
+	_direct = false;
+	_dropBehind = true;
+}
+
+/**
+ * Drop the pages before offset, up to which the file was consumed, from the page cache, once at least
+ * DROP_BEHIND_BYTES are due, in drop behind mode.
+ * Pages are dropped whether or not this read cached them, as the kernel does not tell.
+ */
+void FileHandler::dropBehind(const uint64_t offset) const
+{
+#ifdef __linux__
+	_offset = std::max(_offset, offset);  // for reads not done through read(), e.g. io_uring's.
+	if (!_dropBehind || offset < _dropped + DROP_BEHIND_BYTES)
+		return;
+	(void)posix_fadvise(_descriptor, static_cast<off_t>(_dropped), static_cast<off_t>(offset - _dropped), POSIX_FADV_DONTNEED);
+	Metrics::instance().recordCacheDropped(offset - _dropped);
+	_dropped = offset;
+#else
+	(void)offset;
+#endif
+}
+
 /**
  * Write given bytes from src to fs.
  */
 bool FileHandler::write(const uint8_t* const src, const size_t bytes) const
 {
+	Tracer::Scope trace("FileHandler::write", "io");
 	if (_fileStream == nullptr || !_open || src == nullptr || bytes == 0)
 		return false;
 	try
@@ -170,6 +325,15 @@ bool FileHandler::writeLine(const std::string& line) const
  */
 size_t FileHandler::size() const
 {
+#ifdef __linux__
+	if (_descriptor >= 0)
+	{
+		struct stat status;
+		if (::fstat(_descriptor, &status) != 0 || status.st_size <= 0 || static_cast<uint64_t>(status.st_size) > UINT32_MAX)
+			return 0;
+		return static_cast<size_t>(status.st_size);
+	}
+#endif
 	if (_fileStream == nullptr || !_open)
 		return 0;
 	try
@@ -189,23 +353,26 @@ size_t FileHandler::size() const
 }
 
 /**
- * Open and read file.
- * Caller is responsible for freeing allocated memory upon success.
+ * Open and read file into a pooled buffer.
  */
-bool FileHandler::readAtOnce(const std::string& filepath, uint8_t*& file, size_t& bytes)
+bool FileHandler::readAtOnce(const std::string& filepath, BufferPool::Buffer& file)
 {
-	if (!open(filepath))
+	Tracer::Scope trace("FileHandler::readAtOnce", "io");
+	if (!openSequential(filepath))
 		return false;
 
-	bytes = size();
+	const size_t bytes = size();
 	if (bytes == 0)
+	{
+		close();
 		return false;
+	}
 
-	file = new uint8_t[bytes];
-	const bool success = read(file, bytes);
+	file = BufferPool::instance().acquire(bytes);
+	const bool success = read(file.data(), bytes);
 	if (!success)
 	{
-		delete[] file;
+		file.release();
 	}
 	close();
 	return success;
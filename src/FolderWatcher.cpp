@@ -0,0 +1,305 @@
+/**
+ * Encrypted File Transfer Client
+ * @file FolderWatcher.cpp
+ * @brief Watch a directory tree with Linux inotify for files which finished landing, and hand them out in batches.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "FolderWatcher.h"
+#include "DirectoryScanner.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace
+{
+	constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE |
+		IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+}
+#endif
+
+FolderWatcher::FolderWatcher(const std::chrono::milliseconds debounce, const std::chrono::milliseconds maxDelay, const size_t maxBatch) :
+	_debounce(debounce), _maxDelay(std::max(maxDelay, debounce)), _maxBatch(std::max<size_t>(maxBatch, 1)), _inotify(-1), _wake(-1),
+	_stopped(false), _sequence(0), _started(0), _overflows(0)
+{
+}
+
+FolderWatcher::~FolderWatcher()
+{
+#ifdef __linux__
+	if (_inotify >= 0)
+		(void)::close(_inotify);
+	if (_wake >= 0)
+		(void)::close(_wake);
+#endif
+}
+
+/**
+ * Start watching directory & its subdirectories. Files already there are not queued.
+ * Return false if directory cannot be watched, or on platforms without inotify.
+ */
+bool FolderWatcher::open(const std::string& directory)
+{
+#ifdef __linux__
+	boost::system::error_code errorCode;
+	if (_inotify >= 0 || !boost::filesystem::is_directory(directory, errorCode))
+		return false;
+	_inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	_wake = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_inotify < 0 || _wake < 0)
+		return false;
+	_root = directory;
+	_started = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	watchTree(directory, false);
+	return !_directories.empty();
+#else
+	(void)directory;
+	return false;
+#endif
+}
+
+/**
+ * Wait for the next batch of landed files, in landing order. landed is when its first file landed.
+ * Return false once stopped, or on errors.
+ */
+bool FolderWatcher::nextBatch(std::vector<std::string>& paths, std::chrono::steady_clock::time_point& landed)
+{
+	paths.clear();
+#ifdef __linux__
+	for (;;)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		auto due = queueDelayed(now);
+		if (!_pending.empty())
+		{
+			const auto batchDue = std::min(_last + _debounce, _first + _maxDelay);
+			if (_pending.size() >= _maxBatch || now >= batchDue)
+				break;
+			due = std::min(due, batchDue);
+		}
+		const int timeout = (due == std::chrono::steady_clock::time_point::max()) ? -1 :   // nothing due - wait for events only.
+			static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(due - now).count());
+		pollfd descriptors[2] = { { _inotify, POLLIN, 0 }, { _wake, POLLIN, 0 } };
+		const int result = ::poll(descriptors, 2, timeout);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0 || isStopped())
+			return false;
+		if ((descriptors[0].revents & POLLIN) && !readEvents())
+			return false;
+	}
+
+	Tracer::Scope trace("FolderWatcher::nextBatch", "io");
+	std::vector<std::pair<uint64_t, std::string>> ordered;
+	ordered.reserve(_pending.size());
+	for (const auto& [path, sequence] : _pending)
+		ordered.emplace_back(sequence, path);
+	std::sort(ordered.begin(), ordered.end());
+	if (ordered.size() > _maxBatch)
+		ordered.resize(_maxBatch);
+	for (auto& [sequence, path] : ordered)
+	{
+		_pending.erase(path);
+		paths.push_back(std::move(path));
+	}
+	landed = _first;
+	return true;
+#else
+	(void)landed;
+	return false;
+#endif
+}
+
+/**
+ * Make a blocked or later nextBatch return false. May be called from any thread.
+ */
+void FolderWatcher::stop()
+{
+	_stopped.store(true, std::memory_order_release);
+#ifdef __linux__
+	if (_wake >= 0)
+		(void)::eventfd_write(_wake, 1);
+#endif
+}
+
+/**
+ * Drain inotify's descriptor into the pending batch.
+ */
+bool FolderWatcher::readEvents()
+{
+#ifdef __linux__
+	alignas(inotify_event) char buffer[64 * 1024];
+	for (;;)
+	{
+		const ssize_t size = ::read(_inotify, buffer, sizeof(buffer));
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size < 0 && errno == EAGAIN)
+			return true;  // drained.
+		if (size <= 0)
+			return false;
+		for (const char* position = buffer; position < buffer + size;)
+		{
+			const auto* const event = reinterpret_cast<const inotify_event*>(position);
+			position += sizeof(inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				rescan();
+				continue;
+			}
+			const auto it = _directories.find(event->wd);
+			if (it == _directories.end())
+				continue;
+			if (event->mask & IN_IGNORED)
+			{
+				_directories.erase(it);  // removed, or moved out of the tree.
+				continue;
+			}
+			if (event->len == 0)
+				continue;
+			const std::string path = it->second + '/' + event->name;
+			if (event->mask & IN_ISDIR)
+			{
+				// Files may land in a new directory before its watch is added, so queue those found.
+				if (event->mask & (IN_CREATE | IN_MOVED_TO))
+					watchTree(path, true);
+				else if (event->mask & IN_MOVED_FROM)
+					unwatchTree(path);
+			}
+			else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+			{
+				queue(path);
+			}
+			else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+			{
+				_pending.erase(path);
+				_delayed.erase(path);
+			}
+		}
+	}
+#else
+	return false;
+#endif
+}
+
+/**
+ * Watch directory & its subdirectories. If queueFiles, queue the regular files found.
+ */
+void FolderWatcher::watchTree(const std::string& directory, const bool queueFiles)
+{
+#ifdef __linux__
+	const int descriptor = ::inotify_add_watch(_inotify, directory.c_str(), WATCH_EVENTS);
+	if (descriptor < 0)
+		return;
+	_directories[descriptor] = directory;
+
+	boost::system::error_code errorCode;
+	boost::filesystem::directory_iterator it(directory, errorCode);
+	const boost::filesystem::directory_iterator end;
+	for (; !errorCode && it != end; it.increment(errorCode))
+	{
+		const auto status = it->symlink_status(errorCode);
+		if (errorCode)
+			break;
+		if (boost::filesystem::is_directory(status))
+			watchTree(it->path().string(), queueFiles);
+		else if (queueFiles && boost::filesystem::is_regular_file(status))
+			queue(it->path().string());
+	}
+#else
+	(void)directory; (void)queueFiles;
+#endif
+}
+
+/**
+ * Stop watching directory & its subdirectories, which were moved out of the tree. Drop their pending files.
+ */
+void FolderWatcher::unwatchTree(const std::string& directory)
+{
+#ifdef __linux__
+	const std::string prefix = directory + '/';
+	for (auto it = _directories.begin(); it != _directories.end();)
+	{
+		if (it->second != directory && it->second.compare(0, prefix.size(), prefix) != 0)
+		{
+			++it;
+			continue;
+		}
+		(void)::inotify_rm_watch(_inotify, it->first);
+		it = _directories.erase(it);
+	}
+	for (auto it = _pending.lower_bound(prefix); it != _pending.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+		it = _pending.erase(it);
+	for (auto it = _delayed.lower_bound(prefix); it != _delayed.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+		it = _delayed.erase(it);
+#else
+	(void)directory;
+#endif
+}
+
+/**
+ * Queue a file handed out before once more after delay, e.g. after its upload failed. It is then batched like a file
+ * which just landed. If it lands again meanwhile, it is queued at once.
+ */
+void FolderWatcher::requeue(const std::string& path, const std::chrono::milliseconds delay)
+{
+	_delayed[path] = std::chrono::steady_clock::now() + delay;
+}
+
+void FolderWatcher::queue(const std::string& path)
+{
+	const auto now = std::chrono::steady_clock::now();
+	if (_pending.empty())
+		_first = now;
+	_last = now;
+	if (_pending.find(path) == _pending.end())
+		_pending[path] = _sequence++;
+	_delayed.erase(path);
+}
+
+/**
+ * Queue the requeued files whose delay passed. Return when the next one is due, max() if none is left.
+ */
+std::chrono::steady_clock::time_point FolderWatcher::queueDelayed(const std::chrono::steady_clock::time_point& now)
+{
+	auto next = std::chrono::steady_clock::time_point::max();
+	for (auto it = _delayed.begin(); it != _delayed.end();)
+	{
+		if (it->second > now)
+		{
+			next = std::min(next, it->second);
+			++it;
+			continue;
+		}
+		const std::string path = it->first;
+		it = _delayed.erase(it);
+		queue(path);
+	}
+	return next;
+}
+
+/**
+ * Events were lost. Watch directories created meanwhile, and queue all files written since watching started;
+ * some of them may have been handed out already.
+ */
+void FolderWatcher::rescan()
+{
+	_overflows++;
+	watchTree(_root, false);
+	DirectoryScanner scanner(1, DirectoryScanner::EOrder::ORDER_PATH);
+	std::vector<DirectoryScanner::Entry> entries;
+	if (!scanner.scan(_root, entries))
+		return;
+	for (const auto& entry : entries)
+	{
+		if (entry.modified >= _started)
+			queue(entry.path);
+	}
+}
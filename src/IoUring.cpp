@@ -0,0 +1,163 @@
+/**
+ * Encrypted File Transfer Client
+ * @file IoUring.cpp
+ * @brief Thin wrapper of a Linux io_uring instance (liburing) with registered buffers.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "IoUring.h"
+#if defined(__linux__) && defined(EFT_IO_URING)
+#include <liburing.h>
+#include <sys/uio.h>
+
+struct IoUring::Impl
+{
+	io_uring ring;
+};
+
+/**
+ * Probe once whether the kernel allows setting up a ring (it may be disabled by kernel.io_uring_disabled or seccomp).
+ */
+bool IoUring::isSupported()
+{
+	static const bool supported = []()
+	{
+		io_uring ring;
+		if (io_uring_queue_init(2, &ring, 0) != 0)
+			return false;
+		io_uring_queue_exit(&ring);
+		return true;
+	}();
+	return supported;
+}
+
+IoUring::IoUring(const unsigned entries) : _entries(entries)
+{
+	auto impl = std::make_unique<Impl>();
+	if (io_uring_queue_init(entries, &impl->ring, 0) == 0)
+		_impl = std::move(impl);
+}
+
+IoUring::~IoUring()
+{
+	if (_impl)
+		io_uring_queue_exit(&_impl->ring);
+}
+
+/**
+ * Register buffers, so the kernel maps them once rather than per operation. Index in buffers is the buffer index
+ * passed to prepareRead/Write. May fail, e.g. over RLIMIT_MEMLOCK; operations then use UNREGISTERED buffers.
+ */
+bool IoUring::registerBuffers(const std::vector<std::span<uint8_t>>& buffers)
+{
+	if (!_impl || buffers.empty())
+		return false;
+	std::vector<iovec> vectors(buffers.size());
+	for (size_t i = 0; i < buffers.size(); ++i)
+		vectors[i] = { buffers[i].data(), buffers[i].size() };
+	return io_uring_register_buffers(&_impl->ring, vectors.data(), static_cast<unsigned>(vectors.size())) == 0;
+}
+
+/**
+ * Queue a read of length bytes at file offset into dest, which lies in registered buffer (or UNREGISTERED).
+ * Return false if the submission queue is full.
+ */
+bool IoUring::prepareRead(const int fd, const int buffer, uint8_t* const dest, const size_t length, const uint64_t offset, const uint64_t userData)
+{
+	io_uring_sqe* sqe = _impl ? io_uring_get_sqe(&_impl->ring) : nullptr;
+	if (sqe == nullptr)
+		return false;
+	if (buffer == UNREGISTERED)
+		io_uring_prep_read(sqe, fd, dest, static_cast<unsigned>(length), offset);
+	else
+		io_uring_prep_read_fixed(sqe, fd, dest, static_cast<unsigned>(length), offset, buffer);
+	io_uring_sqe_set_data64(sqe, userData);
+	return true;
+}
+
+/**
+ * Queue a write of length bytes from src, which lies in registered buffer (or UNREGISTERED), at the stream position.
+ * A linked write starts only once this one completed in full; if this one fails or is short, it is cancelled.
+ * Return false if the submission queue is full.
+ */
+bool IoUring::prepareWrite(const int fd, const int buffer, const uint8_t* const src, const size_t length, const bool link, const uint64_t userData)
+{
+	io_uring_sqe* sqe = _impl ? io_uring_get_sqe(&_impl->ring) : nullptr;
+	if (sqe == nullptr)
+		return false;
+	if (buffer == UNREGISTERED)
+		io_uring_prep_write(sqe, fd, src, static_cast<unsigned>(length), static_cast<uint64_t>(-1));
+	else
+		io_uring_prep_write_fixed(sqe, fd, src, static_cast<unsigned>(length), static_cast<uint64_t>(-1), buffer);
+	io_uring_sqe_set_data64(sqe, userData);
+	if (link)
+		io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+	return true;
+}
+
+/**
+ * Submit queued operations and wait for count completions, with a single system call while none is ready yet.
+ * completions is set to the count reaped completions. Return false on ring errors.
+ */
+bool IoUring::submitAndWait(const size_t count, std::vector<Completion>& completions)
+{
+	completions.clear();
+	if (!_impl)
+		return false;
+	if (io_uring_submit_and_wait(&_impl->ring, static_cast<unsigned>(count)) < 0)
+		return false;
+	while (completions.size() < count)
+	{
+		io_uring_cqe* cqe = nullptr;
+		if (io_uring_wait_cqe(&_impl->ring, &cqe) != 0)
+			return false;
+		completions.push_back({ io_uring_cqe_get_data64(cqe), cqe->res });
+		io_uring_cqe_seen(&_impl->ring, cqe);
+	}
+	return true;
+}
+
+#else
+
+struct IoUring::Impl
+{
+};
+
+bool IoUring::isSupported()
+{
+	return false;
+}
+
+IoUring::IoUring(const unsigned entries) : _entries(entries)
+{
+}
+
+IoUring::~IoUring() = default;
+
+bool IoUring::registerBuffers(const std::vector<std::span<uint8_t>>& buffers)
+{
+	(void)buffers;
+	return false;
+}
+
+bool IoUring::prepareRead(const int fd, const int buffer, uint8_t* const dest, const size_t length, const uint64_t offset, const uint64_t userData)
+{
+	(void)fd; (void)buffer; (void)dest; (void)length; (void)offset; (void)userData;
+	return false;
+}
+
+bool IoUring::prepareWrite(const int fd, const int buffer, const uint8_t* const src, const size_t length, const bool link, const uint64_t userData)
+{
+	(void)fd; (void)buffer; (void)src; (void)length; (void)link; (void)userData;
+	return false;
+}
+
+bool IoUring::submitAndWait(const size_t count, std::vector<Completion>& completions)
+{
+	(void)count;
+	completions.clear();
+	return false;
+}
+
+#endif
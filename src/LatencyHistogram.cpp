@@ -0,0 +1,107 @@
+/**
+ * Encrypted File Transfer Client
+ * @file LatencyHistogram.cpp
+ * @brief Lock-free log-linear (HDR style) histogram of latencies in nanoseconds.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "LatencyHistogram.h"
+#include <bit>
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram() : _count(0), _sum(0), _min(UINT64_MAX), _max(0)
+{
+	for (auto& bucket : _buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Values below SUB_BUCKETS are exact. Above, the leading bit selects the exponent
+ * and the next SUB_BUCKET_BITS bits select the linear sub bucket.
+ */
+size_t LatencyHistogram::bucketIndex(const uint64_t value)
+{
+	if (value < SUB_BUCKETS)
+		return static_cast<size_t>(value);
+	const size_t msb = static_cast<size_t>(std::bit_width(value)) - 1;
+	if (msb > MAX_EXPONENT)
+		return BUCKETS - 1;
+	const size_t shift = msb - SUB_BUCKET_BITS;
+	const size_t subBucket = static_cast<size_t>(value >> shift) & (SUB_BUCKETS - 1);
+	return SUB_BUCKETS + shift * SUB_BUCKETS + subBucket;
+}
+
+/**
+ * Highest value which is mapped into bucket index.
+ */
+uint64_t LatencyHistogram::bucketHighest(const size_t index)
+{
+	if (index < SUB_BUCKETS)
+		return index;
+	const size_t shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+	const uint64_t subBucket = (index - SUB_BUCKETS) % SUB_BUCKETS;
+	const uint64_t lowest = (SUB_BUCKETS | subBucket) << shift;
+	return lowest + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(const uint64_t nanos)
+{
+	_buckets[bucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(nanos, std::memory_order_relaxed);
+
+	uint64_t current = _min.load(std::memory_order_relaxed);
+	while (nanos < current && !_min.compare_exchange_weak(current, nanos, std::memory_order_relaxed)) {}
+	current = _max.load(std::memory_order_relaxed);
+	while (nanos > current && !_max.compare_exchange_weak(current, nanos, std::memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::reset()
+{
+	for (auto& bucket : _buckets)
+		bucket.store(0, std::memory_order_relaxed);
+	_count.store(0, std::memory_order_relaxed);
+	_sum.store(0, std::memory_order_relaxed);
+	_min.store(UINT64_MAX, std::memory_order_relaxed);
+	_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::min() const
+{
+	const uint64_t value = _min.load(std::memory_order_relaxed);
+	return (value == UINT64_MAX) ? 0 : value;
+}
+
+uint64_t LatencyHistogram::mean() const
+{
+	const uint64_t samples = count();
+	return (samples == 0) ? 0 : (_sum.load(std::memory_order_relaxed) / samples);
+}
+
+/**
+ * Return the value below which percent (0 - 100) of the samples fall. 0 if empty.
+ * Concurrent records may be partially visible; the result is still within a bucket's error.
+ */
+uint64_t LatencyHistogram::percentile(const double percent) const
+{
+	const uint64_t samples = count();
+	if (samples == 0)
+		return 0;
+	const double clamped = (percent < 0.0) ? 0.0 : ((percent > 100.0) ? 100.0 : percent);
+	uint64_t target = static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(samples)));
+	if (target == 0)
+		target = 1;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKETS; ++i)
+	{
+		seen += _buckets[i].load(std::memory_order_relaxed);
+		if (seen >= target)
+		{
+			const uint64_t highest = bucketHighest(i);
+			return (highest > max()) ? max() : highest;
+		}
+	}
+	return max();
+}
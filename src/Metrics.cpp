@@ -0,0 +1,387 @@
+/**
+ * Encrypted File Transfer Client
+ * @file Metrics.cpp
+ * @brief Per-phase timings & byte counts of client operations and request latency histograms.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "Metrics.h"
+#include "BufferPool.h"
+#include <fstream>
+#include <boost/filesystem.hpp>  // for rename
+
+thread_local Metrics::Transfer* Metrics::_current = nullptr;
+
+Metrics::TransferScope::TransferScope(const char* operation) : _previous(nullptr), _active(Metrics::instance().isEnabled())
+{
+	if (!_active)
+		return;
+	_transfer.operation = operation;
+	_previous = _current;
+	_current = &_transfer;
+	_start = std::chrono::steady_clock::now();
+}
+
+Metrics::TransferScope::~TransferScope()
+{
+	if (!_active)
+		return;
+	_transfer.totalNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+	_current = _previous;
+	try
+	{
+		Metrics::instance().record(_transfer);
+	}
+	catch (...) {} // Do Nothing. Metrics must never fail an operation.
+}
+
+Metrics::PhaseScope::PhaseScope(const EPhase phase, const uint64_t bytes) : _transfer(_current),
+	_phase(static_cast<size_t>(phase)), _bytes(bytes)
+{
+	if (_transfer != nullptr)
+		_start = std::chrono::steady_clock::now();
+}
+
+Metrics::PhaseScope::~PhaseScope()
+{
+	if (_transfer == nullptr)
+		return;
+	_transfer->nanos[_phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+	_transfer->bytes[_phase] += _bytes;
+}
+
+/**
+ * Add a phase timed on another thread (e.g. a stage of a staged upload) to the transfer recorded on the current thread.
+ */
+void Metrics::addPhase(const EPhase phase, const uint64_t nanos, const uint64_t bytes)
+{
+	if (_current == nullptr)
+		return;
+	_current->nanos[static_cast<size_t>(phase)] += nanos;
+	_current->bytes[static_cast<size_t>(phase)] += bytes;
+}
+
+Metrics& Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+/**
+ * Dump latency histograms on exit.
+ */
+Metrics::~Metrics()
+{
+	if (_latencyPath.empty())
+		return;
+	try
+	{
+		std::ofstream out(_latencyPath, std::ios::out | std::ios::trunc);
+		if (out.is_open())
+			dumpLatency(out);
+	}
+	catch (...) {} // Do Nothing
+}
+
+const char* Metrics::phaseName(const EPhase phase)
+{
+	switch (phase)
+	{
+		case EPhase::PHASE_CONNECT:       return "connect";
+		case EPhase::PHASE_READ:          return "read";
+		case EPhase::PHASE_CRC:           return "crc";
+		case EPhase::PHASE_ENCRYPT:       return "encrypt";
+		case EPhase::PHASE_ASSEMBLE:      return "assemble";
+		case EPhase::PHASE_SEND:          return "send";
+		case EPhase::PHASE_RESPONSE_WAIT: return "response_wait";
+		case EPhase::PHASE_DECRYPT:       return "decrypt";
+		default:                          return "unknown";
+	}
+}
+
+const char* Metrics::latencyName(const ELatency latency)
+{
+	switch (latency)
+	{
+		case ELatency::LATENCY_CONNECT:       return "connect";
+		case ELatency::LATENCY_SEND:          return "send";
+		case ELatency::LATENCY_RESPONSE_WAIT: return "response_wait";
+		case ELatency::LATENCY_ROUND_TRIP:    return "round_trip";
+		default:                              return "unknown";
+	}
+}
+
+const char* Metrics::timeoutName(const ETimeout timeout)
+{
+	switch (timeout)
+	{
+		case ETimeout::TIMEOUT_CONNECT:   return "connect";
+		case ETimeout::TIMEOUT_SEND:      return "send";
+		case ETimeout::TIMEOUT_RECEIVE:   return "receive";
+		case ETimeout::TIMEOUT_TRANSFER:  return "transfer";
+		case ETimeout::TIMEOUT_CANCELLED: return "cancelled";
+		default:                          return "unknown";
+	}
+}
+
+const char* Metrics::queueName(const EQueue queue)
+{
+	switch (queue)
+	{
+		case EQueue::QUEUE_READ:   return "read";
+		case EQueue::QUEUE_CRYPTO: return "crypto";
+		default:                   return "unknown";
+	}
+}
+
+/**
+ * Sample the occupancy of a queue. Lock-free, so stages record on every item.
+ */
+void Metrics::recordQueueOccupancy(const EQueue queue, const size_t occupancy, const size_t capacity)
+{
+	auto& counters = _queues[static_cast<size_t>(queue)];
+	counters.samples.fetch_add(1, std::memory_order_relaxed);
+	counters.total.fetch_add(occupancy, std::memory_order_relaxed);
+	counters.capacity.store(capacity, std::memory_order_relaxed);
+	uint64_t max = counters.max.load(std::memory_order_relaxed);
+	while (occupancy > max && !counters.max.compare_exchange_weak(max, occupancy, std::memory_order_relaxed)) {}
+}
+
+Metrics::QueueOccupancy Metrics::queueOccupancy(const EQueue queue) const
+{
+	const auto& counters = _queues[static_cast<size_t>(queue)];
+	QueueOccupancy result;
+	result.samples = counters.samples.load(std::memory_order_relaxed);
+	result.total = counters.total.load(std::memory_order_relaxed);
+	result.max = counters.max.load(std::memory_order_relaxed);
+	result.capacity = counters.capacity.load(std::memory_order_relaxed);
+	return result;
+}
+
+uint64_t Metrics::elapsedNanos(const std::chrono::steady_clock::time_point& since)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+/**
+ * Map a request code to its _latency row. Unknown codes share the last row.
+ */
+size_t Metrics::requestIndex(const code_t code)
+{
+	for (size_t i = 0; i < REQUEST_OPTIONS; ++i)
+		if (REQUEST_CODES[i] == code)
+			return i;
+	return REQUEST_OPTIONS;
+}
+
+/**
+ * Append one JSON line per transfer to path. Empty path disables output.
+ */
+void Metrics::setJsonOutput(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_jsonPath = path;
+}
+
+/**
+ * Rewrite a Prometheus text file on path after each transfer. Empty path disables output.
+ */
+void Metrics::setPrometheusOutput(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_prometheusPath = path;
+}
+
+/**
+ * Write latency histograms summary to path upon exit. Empty path disables output.
+ */
+void Metrics::setLatencyOutput(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_latencyPath = path;
+}
+
+std::map<std::string, Metrics::Totals> Metrics::totals() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _totals;
+}
+
+Metrics::Transfer Metrics::lastTransfer() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _last;
+}
+
+void Metrics::recordLatency(const code_t code, const ELatency latency, const uint64_t nanos)
+{
+	_latency[requestIndex(code)][static_cast<size_t>(latency)].record(nanos);
+}
+
+const LatencyHistogram& Metrics::latency(const code_t code, const ELatency latency) const
+{
+	return _latency[requestIndex(code)][static_cast<size_t>(latency)];
+}
+
+/**
+ * Print a line per request code & latency kind which has samples. Values are in microseconds.
+ */
+void Metrics::dumpLatency(std::ostream& os) const
+{
+	for (size_t i = 0; i <= REQUEST_OPTIONS; ++i)
+	{
+		for (size_t j = 0; j < LATENCIES; ++j)
+		{
+			const auto& histogram = _latency[i][j];
+			if (histogram.count() == 0)
+				continue;
+			os << "code=" << ((i < REQUEST_OPTIONS) ? std::to_string(REQUEST_CODES[i]) : "other")
+				<< " latency=" << latencyName(static_cast<ELatency>(j)) << " count=" << histogram.count()
+				<< " min_us=" << histogram.min() / 1e3 << " mean_us=" << histogram.mean() / 1e3
+				<< " p50_us=" << histogram.percentile(50.0) / 1e3 << " p99_us=" << histogram.percentile(99.0) / 1e3
+				<< " p999_us=" << histogram.percentile(99.9) / 1e3 << " max_us=" << histogram.max() / 1e3 << '\n';
+		}
+	}
+	for (size_t i = 0; i < TIMEOUTS; ++i)
+	{
+		if (timeouts(static_cast<ETimeout>(i)) > 0)
+			os << "timeout=" << timeoutName(static_cast<ETimeout>(i)) << " count=" << timeouts(static_cast<ETimeout>(i)) << '\n';
+	}
+	for (size_t i = 0; i < QUEUES; ++i)
+	{
+		const auto occupancy = queueOccupancy(static_cast<EQueue>(i));
+		if (occupancy.samples > 0)
+			os << "queue=" << queueName(static_cast<EQueue>(i)) << " samples=" << occupancy.samples
+				<< " mean=" << static_cast<double>(occupancy.total) / occupancy.samples << " max=" << occupancy.max
+				<< " capacity=" << occupancy.capacity << '\n';
+	}
+	if (fileReadBytes(false) > 0 || fileReadBytes(true) > 0)
+		os << "file_read cached_bytes=" << fileReadBytes(false) << " direct_bytes=" << fileReadBytes(true)
+			<< " dropped_bytes=" << cacheDroppedBytes() << '\n';
+}
+
+/**
+ * Accumulate a finished transfer and update output files.
+ */
+void Metrics::record(const Transfer& transfer)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto& totals = _totals[transfer.operation];
+	totals.transfers++;
+	if (!transfer.success)
+		totals.failures++;
+	totals.totalNanos += transfer.totalNanos;
+	for (size_t i = 0; i < PHASES; ++i)
+	{
+		totals.nanos[i] += transfer.nanos[i];
+		totals.bytes[i] += transfer.bytes[i];
+	}
+	_last = transfer;
+
+	if (!_jsonPath.empty())
+		writeJsonLine(transfer);
+	if (!_prometheusPath.empty())
+		writePrometheus();
+}
+
+/**
+ * Caller must hold _mutex.
+ */
+void Metrics::writeJsonLine(const Transfer& transfer) const
+{
+	std::ofstream out(_jsonPath, std::ios::out | std::ios::app);
+	if (!out.is_open())
+		return;
+	out << "{\"operation\":\"" << transfer.operation << "\",\"success\":" << (transfer.success ? "true" : "false")
+		<< ",\"total_ns\":" << transfer.totalNanos << ",\"phases\":{";
+	for (size_t i = 0; i < PHASES; ++i)
+	{
+		out << (i == 0 ? "" : ",") << '"' << phaseName(static_cast<EPhase>(i)) << "\":{\"ns\":" << transfer.nanos[i]
+			<< ",\"bytes\":" << transfer.bytes[i] << '}';
+	}
+	out << "}}\n";
+}
+
+/**
+ * Write to a temporary file and rename it, so a scraper never reads a partial file.
+ * Caller must hold _mutex.
+ */
+void Metrics::writePrometheus() const
+{
+	const std::string tempPath = _prometheusPath + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::out | std::ios::trunc);
+		if (!out.is_open())
+			return;
+		out << "# HELP eft_transfers_total Client operations recorded.\n# TYPE eft_transfers_total counter\n";
+		for (const auto& [operation, totals] : _totals)
+			out << "eft_transfers_total{operation=\"" << operation << "\"} " << totals.transfers << '\n';
+		out << "# HELP eft_transfer_failures_total Client operations which failed.\n# TYPE eft_transfer_failures_total counter\n";
+		for (const auto& [operation, totals] : _totals)
+			out << "eft_transfer_failures_total{operation=\"" << operation << "\"} " << totals.failures << '\n';
+		out << "# HELP eft_transfer_seconds_total Wall time of client operations.\n# TYPE eft_transfer_seconds_total counter\n";
+		for (const auto& [operation, totals] : _totals)
+			out << "eft_transfer_seconds_total{operation=\"" << operation << "\"} " << totals.totalNanos / 1e9 << '\n';
+		out << "# HELP eft_phase_seconds_total Time spent per operation phase.\n# TYPE eft_phase_seconds_total counter\n";
+		for (const auto& [operation, totals] : _totals)
+			for (size_t i = 0; i < PHASES; ++i)
+				out << "eft_phase_seconds_total{operation=\"" << operation << "\",phase=\"" << phaseName(static_cast<EPhase>(i))
+					<< "\"} " << totals.nanos[i] / 1e9 << '\n';
+		out << "# HELP eft_phase_bytes_total Bytes processed per operation phase.\n# TYPE eft_phase_bytes_total counter\n";
+		for (const auto& [operation, totals] : _totals)
+			for (size_t i = 0; i < PHASES; ++i)
+				out << "eft_phase_bytes_total{operation=\"" << operation << "\",phase=\"" << phaseName(static_cast<EPhase>(i))
+					<< "\"} " << totals.bytes[i] << '\n';
+		out << "# HELP eft_request_latency_seconds Request latency per request code.\n# TYPE eft_request_latency_seconds summary\n";
+		for (size_t i = 0; i < REQUEST_OPTIONS; ++i)
+		{
+			for (size_t j = 0; j < LATENCIES; ++j)
+			{
+				const auto& histogram = _latency[i][j];
+				if (histogram.count() == 0)
+					continue;
+				const std::string labels = "code=\"" + std::to_string(REQUEST_CODES[i]) + "\",latency=\"" + latencyName(static_cast<ELatency>(j)) + '"';
+				for (const double quantile : { 0.5, 0.99, 0.999 })
+					out << "eft_request_latency_seconds{" << labels << ",quantile=\"" << quantile << "\"} "
+						<< histogram.percentile(quantile * 100.0) / 1e9 << '\n';
+				out << "eft_request_latency_seconds_count{" << labels << "} " << histogram.count() << '\n';
+			}
+		}
+		const auto pool = BufferPool::instance().stats();
+		out << "# HELP eft_buffer_pool_hits_total Buffers served from the pool.\n# TYPE eft_buffer_pool_hits_total counter\n"
+			<< "eft_buffer_pool_hits_total " << pool.hits << '\n'
+			<< "# HELP eft_buffer_pool_misses_total Buffers allocated on demand.\n# TYPE eft_buffer_pool_misses_total counter\n"
+			<< "eft_buffer_pool_misses_total " << pool.misses << '\n'
+			<< "# HELP eft_buffer_pool_discards_total Released buffers freed since the pool was full.\n# TYPE eft_buffer_pool_discards_total counter\n"
+			<< "eft_buffer_pool_discards_total " << pool.discards << '\n'
+			<< "# HELP eft_buffer_pool_cached_bytes Bytes cached by the pool.\n# TYPE eft_buffer_pool_cached_bytes gauge\n"
+			<< "eft_buffer_pool_cached_bytes " << pool.cachedBytes << '\n';
+		out << "# HELP eft_concurrency_window Adaptive limit of concurrent transfers. 0 if disabled.\n# TYPE eft_concurrency_window gauge\n"
+			<< "eft_concurrency_window " << concurrencyWindow() << '\n';
+		out << "# HELP eft_timeouts_total Socket operations aborted by a deadline or cancellation.\n# TYPE eft_timeouts_total counter\n";
+		for (size_t i = 0; i < TIMEOUTS; ++i)
+			out << "eft_timeouts_total{operation=\"" << timeoutName(static_cast<ETimeout>(i)) << "\"} " << timeouts(static_cast<ETimeout>(i)) << '\n';
+		out << "# HELP eft_queue_occupancy Items waiting between staged upload stages, as seen by the consumer.\n# TYPE eft_queue_occupancy summary\n";
+		for (size_t i = 0; i < QUEUES; ++i)
+		{
+			const auto occupancy = queueOccupancy(static_cast<EQueue>(i));
+			const std::string labels = std::string("queue=\"") + queueName(static_cast<EQueue>(i)) + '"';
+			out << "eft_queue_occupancy_sum{" << labels << "} " << occupancy.total << '\n'
+				<< "eft_queue_occupancy_count{" << labels << "} " << occupancy.samples << '\n';
+		}
+		out << "# HELP eft_queue_occupancy_max Most items seen waiting between staged upload stages.\n# TYPE eft_queue_occupancy_max gauge\n";
+		for (size_t i = 0; i < QUEUES; ++i)
+			out << "eft_queue_occupancy_max{queue=\"" << queueName(static_cast<EQueue>(i)) << "\"} " << queueOccupancy(static_cast<EQueue>(i)).max << '\n';
+		out << "# HELP eft_queue_capacity Capacity of the queues between staged upload stages.\n# TYPE eft_queue_capacity gauge\n";
+		for (size_t i = 0; i < QUEUES; ++i)
+			out << "eft_queue_capacity{queue=\"" << queueName(static_cast<EQueue>(i)) << "\"} " << queueOccupancy(static_cast<EQueue>(i)).capacity << '\n';
+		out << "# HELP eft_file_read_bytes_total File bytes read, through the page cache or bypassing it.\n# TYPE eft_file_read_bytes_total counter\n"
+			<< "eft_file_read_bytes_total{cache=\"cached\"} " << fileReadBytes(false) << '\n'
+			<< "eft_file_read_bytes_total{cache=\"direct\"} " << fileReadBytes(true) << '\n'
+			<< "# HELP eft_page_cache_dropped_bytes_total Read file bytes dropped from the page cache.\n# TYPE eft_page_cache_dropped_bytes_total counter\n"
+			<< "eft_page_cache_dropped_bytes_total " << cacheDroppedBytes() << '\n';
+	}
+	boost::system::error_code errorCode;  // rename() will not throw exception when error_code is passed as argument.
+	boost::filesystem::rename(tempPath, _prometheusPath, errorCode);
+}
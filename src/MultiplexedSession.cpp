@@ -0,0 +1,229 @@
+/**
+ * Encrypted File Transfer Client
+ * @file MultiplexedSession.cpp
+ * @brief Multiplex several requests over a single connection (protocol version 4).
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "MultiplexedSession.h"
+#include "SocketHandler.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "Serializer.h"
+#include <algorithm>
+#include <cstring>
+
+MultiplexedSession::MultiplexedSession(SocketHandler& socket) : _socket(socket), _nextStreamId(1)
+{
+}
+
+/**
+ * Upgrade the connection by a RequestUpgradeMultiplexed, framed as a classic request, and wait for the server to
+ * accept it. No frame may be sent before.
+ * Return false if the server refused, e.g. a server which speaks classic requests only, or on connection errors.
+ */
+bool MultiplexedSession::open(const ClientID& clientId)
+{
+	Tracer::Scope trace("MultiplexedSession::open", "net");
+	const RequestUpgradeMultiplexed request(clientId);
+	uint8_t wire[sizeof(request)];
+	memcpy(wire, &request, sizeof(request));
+	Serializer::toWire<RequestUpgradeMultiplexed>(wire);
+
+	ResponseMultiplexedAccepted response;
+	size_t received = 0;
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, sizeof(wire));
+		if (!_socket.send(wire, sizeof(wire)))
+			return false;
+	}
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_RESPONSE_WAIT, sizeof(response));
+		if (!_socket.receiveResponse(reinterpret_cast<uint8_t*>(&response), sizeof(response), received))
+			return false;  // e.g. a longer error response.
+	}
+	Serializer::fromWire<ResponseMultiplexedAccepted>(reinterpret_cast<uint8_t*>(&response));
+	return (received == sizeof(response)) && (response.header.code == MessageDescriptor<ResponseMultiplexedAccepted>::code);
+}
+
+/**
+ * Queue a request message (wire byte order) on a new stream. Return the stream's id.
+ * Streams which expect no response complete once fully sent.
+ */
+stream_t MultiplexedSession::submit(BufferPool::Buffer&& message, const bool expectResponse)
+{
+	const stream_t streamId = _nextStreamId;
+	_nextStreamId += 2;  // client opened streams are odd.
+
+	Stream& stream = _streams[streamId];
+	stream.expectResponse = expectResponse;
+	stream.submittedAt = std::chrono::steady_clock::now();
+	if (message.size() >= sizeof(RequestHeader))
+		stream.code = Serializer::wire(reinterpret_cast<const RequestHeader*>(message.data())->code);
+	stream.message = std::move(message);
+	return streamId;
+}
+
+stream_t MultiplexedSession::submit(const uint8_t* const message, const size_t size, const bool expectResponse)
+{
+	BufferPool::Buffer buffer = BufferPool::instance().acquire(size);
+	memcpy(buffer.data(), message, size);
+	return submit(std::move(buffer), expectResponse);
+}
+
+/**
+ * Drive the connection until a stream completes. Frames are sent while the server has nothing to say,
+ * and received whenever input is pending or no stream may send.
+ * Return false on connection or protocol errors, or if nothing is outstanding.
+ */
+bool MultiplexedSession::next(Completion& completion)
+{
+	Tracer::Scope trace("MultiplexedSession::next", "net");
+	while (_completed.empty())
+	{
+		if (_streams.empty())
+			return false;
+
+		const stream_t streamId = nextSendable();
+		if (streamId != DEFAULT_VALUE && !_socket.hasPendingInput())
+		{
+			if (!sendFrame(streamId, _streams.at(streamId)))
+				return false;
+		}
+		else if (!receiveFrame())
+		{
+			return false;
+		}
+	}
+	completion = std::move(_completed.front());
+	_completed.pop_front();
+	return true;
+}
+
+/**
+ * Pick the stream with the fewest bytes left to send among those with an open window. 0 if none.
+ */
+stream_t MultiplexedSession::nextSendable() const
+{
+	stream_t best = DEFAULT_VALUE;
+	size_t bestLeft = SIZE_MAX;
+	for (const auto& [streamId, stream] : _streams)
+	{
+		if (!stream.message || stream.window == 0)
+			continue;  // fully sent or blocked by flow control.
+		const size_t left = stream.message.size() - stream.sent;
+		if (left < bestLeft)
+		{
+			best = streamId;
+			bestLeft = left;
+		}
+	}
+	return best;
+}
+
+/**
+ * Send the next DATA frame of stream, bounded by FRAME_PAYLOAD_SIZE and the stream's window.
+ */
+bool MultiplexedSession::sendFrame(const stream_t streamId, Stream& stream)
+{
+	const size_t left = stream.message.size() - stream.sent;
+	const size_t length = std::min({ left, FRAME_PAYLOAD_SIZE, static_cast<size_t>(stream.window) });
+
+	FrameHeader header;
+	header.type = FRAME_DATA;
+	header.flags = static_cast<uint8_t>((length == left) ? FRAME_END_STREAM : 0);
+	header.streamId = streamId;
+	header.length = static_cast<csize_t>(length);
+	Serializer::toWire<FrameHeader>(reinterpret_cast<uint8_t*>(&header));
+
+	Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, sizeof(header) + length);
+	if (!_socket.sendUnpadded(reinterpret_cast<const uint8_t*>(&header), sizeof(header), stream.message.data() + stream.sent, length))
+		return false;
+
+	stream.sent += length;
+	stream.window -= static_cast<csize_t>(length);
+	if (stream.sent == stream.message.size())
+	{
+		stream.message.release();  // fully sent. return buffer to pool early.
+		if (!stream.expectResponse)
+			complete(streamId, false);
+	}
+	return true;
+}
+
+/**
+ * Receive a single frame and apply it to its stream. Frames of unknown streams are discarded.
+ */
+bool MultiplexedSession::receiveFrame()
+{
+	FrameHeader header;
+	{
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_RESPONSE_WAIT, sizeof(header));
+		if (!_socket.receive(reinterpret_cast<uint8_t*>(&header), sizeof(header)))
+			return false;
+	}
+	Serializer::fromWire<FrameHeader>(reinterpret_cast<uint8_t*>(&header));
+	if (header.version != MULTIPLEXED_VERSION || header.length > FRAME_PAYLOAD_SIZE)
+		return false;
+
+	uint8_t payload[FRAME_PAYLOAD_SIZE];
+	if (header.length > 0 && !_socket.receive(payload, header.length))
+		return false;
+
+	const auto it = _streams.find(header.streamId);
+	if (it == _streams.end())
+		return true;  // stream already completed or unknown.
+	Stream& stream = it->second;
+
+	switch (header.type)
+	{
+	case FRAME_DATA:
+		if (stream.response.size() + header.length > MAX_RESPONSE_SIZE)
+			return false;
+		stream.response.insert(stream.response.end(), payload, payload + header.length);
+		if (header.flags & FRAME_END_STREAM)
+			complete(header.streamId, false);
+		return true;
+
+	case FRAME_WINDOW_UPDATE:
+	{
+		if (header.length != sizeof(csize_t))
+			return false;
+		csize_t increment;
+		memcpy(&increment, payload, sizeof(increment));
+		increment = Serializer::wire(increment);
+		const uint64_t window = static_cast<uint64_t>(stream.window) + increment;
+		stream.window = static_cast<csize_t>(std::min<uint64_t>(window, UINT32_MAX));
+		return true;
+	}
+
+	case FRAME_RESET:
+		complete(header.streamId, true);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * Move stream into the completed queue & record its round trip latency.
+ */
+void MultiplexedSession::complete(const stream_t streamId, const bool reset)
+{
+	auto it = _streams.find(streamId);
+	if (it == _streams.end())
+		return;
+	Stream& stream = it->second;
+	Completion completion;
+	completion.streamId = streamId;
+	completion.reset = reset;
+	completion.requestBytes = stream.sent;
+	completion.latencyNanos = Metrics::elapsedNanos(stream.submittedAt);
+	Metrics::instance().recordLatency(stream.code, Metrics::ELatency::LATENCY_ROUND_TRIP, completion.latencyNanos);
+	if (!reset)
+		completion.response = std::move(stream.response);
+	_completed.push_back(std::move(completion));
+	_streams.erase(it);
+}
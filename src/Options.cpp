@@ -0,0 +1,112 @@
+/**
+ * Encrypted File Transfer Client
+ * @file Options.cpp
+ * @brief Optional client settings. Parsed from "key = value" lines.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "Options.h"
+#include "Stringer.h"
+#include <algorithm>
+#include <fstream>
+
+/**
+ * Parse a single "key = value" line. Lines starting with '#' are comments.
+ * Return false if line has invalid format.
+ */
+bool Options::parseLine(const std::string& line)
+{
+	std::string trimmed = line;
+	Stringer::trim(trimmed);
+	if (trimmed.empty() || trimmed[0] == '#')
+		return true;
+
+	const auto pos = trimmed.find('=');
+	if (pos == std::string::npos)
+		return false;
+
+	std::string key = trimmed.substr(0, pos);
+	std::string value = trimmed.substr(pos + 1);
+	Stringer::trim(key);
+	Stringer::trim(value);
+	if (key.empty())
+		return false;
+
+	std::transform(key.begin(), key.end(), key.begin(), [](const unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+	_values[key] = value;
+	return true;
+}
+
+/**
+ * Parse all lines of path. A missing file is not an error unless required.
+ */
+bool Options::parseFile(const std::string& path, const bool required)
+{
+	std::ifstream in(path);
+	if (!in.is_open())
+		return !required;  // optional file.
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (!parseLine(line))
+			return false;
+	}
+	return true;
+}
+
+bool Options::contains(const std::string& key) const
+{
+	return _values.find(key) != _values.end();
+}
+
+std::string Options::getString(const std::string& key, const std::string& defaultValue) const
+{
+	const auto it = _values.find(key);
+	return (it == _values.end()) ? defaultValue : it->second;
+}
+
+/**
+ * Return defaultValue if key is missing or value is not a number.
+ */
+uint64_t Options::getUInt(const std::string& key, const uint64_t defaultValue) const
+{
+	const auto it = _values.find(key);
+	if (it == _values.end())
+		return defaultValue;
+	try
+	{
+		return std::stoull(it->second);
+	}
+	catch (...)
+	{
+		return defaultValue;
+	}
+}
+
+/**
+ * Accept true/false, yes/no, on/off and 1/0.
+ */
+bool Options::getBool(const std::string& key, const bool defaultValue) const
+{
+	const auto it = _values.find(key);
+	if (it == _values.end())
+		return defaultValue;
+	const auto& value = it->second;
+	if (value == "1" || value == "true" || value == "yes" || value == "on")
+		return true;
+	if (value == "0" || value == "false" || value == "no" || value == "off")
+		return false;
+	return defaultValue;
+}
+
+/**
+ * Return all keys starting with prefix, in order.
+ */
+std::vector<std::string> Options::keys(const std::string& prefix) const
+{
+	std::vector<std::string> result;
+	for (auto it = _values.lower_bound(prefix); it != _values.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+		result.push_back(it->first);
+	return result;
+}
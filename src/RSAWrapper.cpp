@@ -8,6 +8,7 @@
 #include "pch.h"
 #include "RSAWrapper.h"
 #include "protocol.h"
+#include "Tracer.h"
 
 
 RSAPublicWrapper::RSAPublicWrapper(const PublicKey& publicKey)
@@ -18,11 +19,13 @@ RSAPublicWrapper::RSAPublicWrapper(const PublicKey& publicKey)
 
 RSAPrivateWrapper::RSAPrivateWrapper()
 {
+	Tracer::Scope trace("RSAPrivateWrapper::generate", "crypto");
 	_privateKey.Initialize(_rng, BITS);
 }
 
 RSAPrivateWrapper::RSAPrivateWrapper(const std::string& key)
 {
+	Tracer::Scope trace("RSAPrivateWrapper::load", "crypto");
 	CryptoPP::StringSource ss(key, true);
 	_privateKey.Load(ss);
 }
@@ -46,8 +49,34 @@ std::string RSAPrivateWrapper::getPublicKey() const
 
 std::string RSAPrivateWrapper::decrypt(const uint8_t* cipher, size_t length)
 {
+	Tracer::Scope trace("RSAPrivateWrapper::decrypt", "crypto");
 	std::string decrypted;
 	CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
 	CryptoPP::StringSource ss_cipher((cipher), length, true, new CryptoPP::PK_DecryptorFilter(_rng, d, new CryptoPP::StringSink(decrypted)));
 	return decrypted;
 }
+
+/**
+ * Decrypt cipher into a caller provided buffer.
+ * Return plain text length. 0 if decryption failed or plain is too small.
+ */
+size_t RSAPrivateWrapper::decrypt(std::span<const uint8_t> cipher, std::span<uint8_t> plain)
+{
+	Tracer::Scope trace("RSAPrivateWrapper::decrypt", "crypto");
+	const CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
+	const size_t maxLength = d.MaxPlaintextLength(cipher.size());
+	if (maxLength == 0)
+		return 0;
+
+	// Crypto++ requires room for the longest possible plain text. Use a stack buffer when plain is shorter.
+	CryptoPP::byte temp[BITS / 8];
+	const bool direct = (plain.size() >= maxLength);
+	if (!direct && maxLength > sizeof(temp))
+		return 0;
+	const auto result = d.Decrypt(_rng, cipher.data(), cipher.size(), direct ? plain.data() : temp);
+	if (!result.isValidCoding || result.messageLength > plain.size())
+		return 0;
+	if (!direct)
+		memcpy(plain.data(), temp, result.messageLength);
+	return result.messageLength;
+}
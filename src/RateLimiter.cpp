@@ -0,0 +1,150 @@
+/**
+ * Encrypted File Transfer Client
+ * @file RateLimiter.cpp
+ * @brief Token bucket bandwidth shaping of outgoing traffic, globally and per server.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "RateLimiter.h"
+#include "Options.h"
+#include <algorithm>
+#include <csignal>
+#include <thread>
+
+constexpr auto SERVER_LIMIT_PREFIX = "rate_limit.";
+
+RateLimiter& RateLimiter::instance()
+{
+	static RateLimiter limiter;
+	return limiter;
+}
+
+/**
+ * Apply a new limit. Saved tokens are kept, bounded by the new burst.
+ */
+void RateLimiter::TokenBucket::setLimit(const uint64_t rate, const uint64_t burst)
+{
+	_rate = static_cast<double>(rate);
+	_burst = static_cast<double>((burst != 0) ? burst : std::max(MIN_BURST, rate / 10));
+	_tokens = std::min(_tokens, _burst);
+}
+
+/**
+ * Take bytes worth of tokens, going negative if needed. Return nanoseconds to wait until the debt is repaid.
+ */
+uint64_t RateLimiter::TokenBucket::reserve(const size_t bytes, const std::chrono::steady_clock::time_point& now)
+{
+	if (_rate <= 0)
+		return 0;
+	const double elapsed = std::chrono::duration<double>(now - _last).count();
+	_last = now;
+	_tokens = std::min(_burst, _tokens + elapsed * _rate);
+	_tokens -= static_cast<double>(bytes);
+	return (_tokens >= 0) ? 0 : static_cast<uint64_t>(-_tokens / _rate * 1e9);
+}
+
+void RateLimiter::setGlobalLimit(const uint64_t rate, const uint64_t burst)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_global.setLimit(rate, burst);
+	updateEnabled();
+}
+
+void RateLimiter::setServerLimit(const std::string& server, const uint64_t rate, const uint64_t burst)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (rate == 0)
+		_servers.erase(server);
+	else
+		_servers[server].setLimit(rate, burst);
+	updateEnabled();
+}
+
+/**
+ * Apply rate_limit & rate_burst, and per server rate_limit.<address:port> & rate_burst.<address:port>.
+ * Server limits missing from options are removed.
+ */
+void RateLimiter::configure(const Options& options)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_global.setLimit(options.getUInt("rate_limit"), options.getUInt("rate_burst"));
+
+	std::map<std::string, TokenBucket> servers;
+	for (const auto& key : options.keys(SERVER_LIMIT_PREFIX))
+	{
+		const std::string server = key.substr(std::char_traits<char>::length(SERVER_LIMIT_PREFIX));
+		const uint64_t rate = options.getUInt(key);
+		if (server.empty() || rate == 0)
+			continue;
+		const auto it = _servers.find(server);
+		TokenBucket& bucket = servers[server];
+		if (it != _servers.end())
+			bucket = it->second;  // keep state of an existing bucket.
+		bucket.setLimit(rate, options.getUInt("rate_burst." + server));
+	}
+	_servers = std::move(servers);
+	updateEnabled();
+}
+
+void RateLimiter::updateEnabled()
+{
+	_enabled.store(_global.isLimited() || !_servers.empty(), std::memory_order_relaxed);
+}
+
+/**
+ * Block until bytes may be sent to server. A pending reload is applied first.
+ */
+void RateLimiter::acquire(const std::string& server, const size_t bytes)
+{
+	if (_reloadRequested.exchange(false, std::memory_order_relaxed))
+		reload();
+	if (!_enabled.load(std::memory_order_relaxed))
+		return;
+
+	uint64_t waitNanos;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		const auto now = std::chrono::steady_clock::now();
+		waitNanos = _global.reserve(bytes, now);
+		const auto it = _servers.find(server);
+		if (it != _servers.end())
+			waitNanos = std::max(waitNanos, it->second.reserve(bytes, now));
+	}
+	if (waitNanos > 0)
+		std::this_thread::sleep_for(std::chrono::nanoseconds(waitNanos));
+}
+
+void RateLimiter::setReloadSource(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_reloadPath = path;
+}
+
+/**
+ * Re-read limits from the reload source. Other options are ignored. Invalid or missing files (e.g. mid-rename by an
+ * editor) keep the current limits.
+ */
+void RateLimiter::reload()
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		path = _reloadPath;
+	}
+	Options options;
+	if (!path.empty() && options.parseFile(path, true))
+		configure(options);
+}
+
+/**
+ * Request a reload upon SIGHUP (SIGBREAK - Ctrl+Break on Windows). The handler only sets a flag.
+ */
+void RateLimiter::installReloadSignal()
+{
+#if defined(SIGHUP)
+	std::signal(SIGHUP, [](int) { RateLimiter::instance().requestReload(); });
+#elif defined(SIGBREAK)
+	std::signal(SIGBREAK, [](int) { RateLimiter::instance().requestReload(); });
+#endif
+}
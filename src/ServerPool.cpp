@@ -0,0 +1,221 @@
+/**
+ * Encrypted File Transfer Client
+ * @file ServerPool.cpp
+ * @brief List of server endpoints with health tracking & load balancing.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "ServerPool.h"
+#include <algorithm>
+
+ServerPool::ServerPool() : _strategy(EStrategy::ROUND_ROBIN), _next(0), _random(std::random_device{}())
+{
+}
+
+/**
+ * Accept round_robin, least_outstanding & consistent_hash.
+ */
+bool ServerPool::parseStrategy(const std::string& name, EStrategy& strategy)
+{
+	if (name == "round_robin")
+		strategy = EStrategy::ROUND_ROBIN;
+	else if (name == "least_outstanding")
+		strategy = EStrategy::LEAST_OUTSTANDING;
+	else if (name == "consistent_hash")
+		strategy = EStrategy::CONSISTENT_HASH;
+	else
+		return false;
+	return true;
+}
+
+void ServerPool::add(const std::string& address, const std::string& port)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Server server;
+	server.address = address;
+	server.port = port;
+	_servers.push_back(server);
+	rebuildRing();
+}
+
+void ServerPool::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_servers.clear();
+	_ring.clear();
+	_next = 0;
+}
+
+size_t ServerPool::size() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _servers.size();
+}
+
+ServerPool::Server ServerPool::server(const size_t index) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _servers.at(index);
+}
+
+void ServerPool::setStrategy(const EStrategy strategy)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_strategy = strategy;
+}
+
+/**
+ * Select a server by strategy among the healthy ones. If none is healthy, the one which recovers first.
+ * Pool must not be empty.
+ */
+size_t ServerPool::select(const ClientID& clientId)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto now = std::chrono::steady_clock::now();
+	const bool anyHealthy = std::any_of(_servers.begin(), _servers.end(), [&](const Server& server) { return isHealthy(server, now); });
+	if (!anyHealthy)
+	{
+		const auto it = std::min_element(_servers.begin(), _servers.end(),
+			[](const Server& lhs, const Server& rhs) { return lhs.retryAt < rhs.retryAt; });
+		return static_cast<size_t>(it - _servers.begin());
+	}
+
+	switch (_strategy)
+	{
+	case EStrategy::LEAST_OUTSTANDING:
+	{
+		size_t best = _servers.size();
+		for (size_t i = 0; i < _servers.size(); ++i)
+		{
+			// Scan from the round robin position, so ties are spread.
+			const size_t index = (_next + i) % _servers.size();
+			if (isHealthy(_servers[index], now) && (best == _servers.size() || _servers[index].outstanding < _servers[best].outstanding))
+				best = index;
+		}
+		_next = (best + 1) % _servers.size();
+		return best;
+	}
+	case EStrategy::CONSISTENT_HASH:
+		return selectConsistent(clientId, now);
+	case EStrategy::ROUND_ROBIN:
+	default:
+		for (size_t i = 0; i < _servers.size(); ++i)
+		{
+			const size_t index = (_next + i) % _servers.size();
+			if (isHealthy(_servers[index], now))
+			{
+				_next = (index + 1) % _servers.size();
+				return index;
+			}
+		}
+		return 0;  // not reached. A healthy server exists.
+	}
+}
+
+/**
+ * Return false while server is backing off from connect failures.
+ */
+bool ServerPool::isHealthy(const size_t index) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return isHealthy(_servers.at(index), std::chrono::steady_clock::now());
+}
+
+/**
+ * First healthy server clockwise from the client's point on the ring.
+ */
+size_t ServerPool::selectConsistent(const ClientID& clientId, const std::chrono::steady_clock::time_point& now) const
+{
+	const uint64_t point = hash(clientId.uuid, sizeof(clientId.uuid));
+	auto it = std::lower_bound(_ring.begin(), _ring.end(), std::make_pair(point, static_cast<size_t>(0)));
+	for (size_t i = 0; i < _ring.size(); ++i, ++it)
+	{
+		if (it == _ring.end())
+			it = _ring.begin();
+		if (isHealthy(_servers[it->second], now))
+			return it->second;
+	}
+	return 0;  // not reached. A healthy server exists.
+}
+
+void ServerPool::onConnected(const size_t index)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Server& server = _servers.at(index);
+	server.failures = 0;
+	server.retryAt = std::chrono::steady_clock::time_point();
+	server.outstanding++;
+}
+
+/**
+ * Back off from server for BASE_BACKOFF * 2^(failures - 1), jittered by +-50% & clamped to MAX_BACKOFF.
+ */
+void ServerPool::onFailure(const size_t index)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Server& server = _servers.at(index);
+	server.failures++;
+	const size_t shift = std::min<size_t>(server.failures - 1, 16);
+	const auto backoff = std::min<std::chrono::milliseconds>(BASE_BACKOFF * (static_cast<int64_t>(1) << shift), MAX_BACKOFF);
+	std::uniform_real_distribution<double> jitter(0.5, 1.5);
+	const auto jittered = std::chrono::duration_cast<std::chrono::milliseconds>(backoff * jitter(_random));
+	server.retryAt = std::chrono::steady_clock::now() + std::min<std::chrono::milliseconds>(jittered, MAX_BACKOFF);
+}
+
+void ServerPool::onCompleted(const size_t index)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Server& server = _servers.at(index);
+	if (server.outstanding > 0)
+		server.outstanding--;
+}
+
+/**
+ * Time until the first server leaves backoff. Zero if one is healthy already.
+ */
+std::chrono::steady_clock::duration ServerPool::timeUntilHealthy() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto now = std::chrono::steady_clock::now();
+	auto earliest = std::chrono::steady_clock::time_point::max();
+	for (const auto& server : _servers)
+		earliest = std::min(earliest, server.retryAt);
+	return (_servers.empty() || earliest <= now) ? std::chrono::steady_clock::duration::zero() : (earliest - now);
+}
+
+bool ServerPool::isHealthy(const Server& server, const std::chrono::steady_clock::time_point& now) const
+{
+	return server.retryAt <= now;
+}
+
+/**
+ * Place VIRTUAL_NODES points per server on the ring. Caller must hold _mutex.
+ */
+void ServerPool::rebuildRing()
+{
+	_ring.clear();
+	for (size_t i = 0; i < _servers.size(); ++i)
+	{
+		for (size_t node = 0; node < VIRTUAL_NODES; ++node)
+		{
+			const std::string key = _servers[i].address + ':' + _servers[i].port + '#' + std::to_string(node);
+			_ring.emplace_back(hash(reinterpret_cast<const uint8_t*>(key.data()), key.size()), i);
+		}
+	}
+	std::sort(_ring.begin(), _ring.end());
+}
+
+/**
+ * FNV-1a 64 bit.
+ */
+uint64_t ServerPool::hash(const uint8_t* data, const size_t size)
+{
+	uint64_t result = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i)
+	{
+		result ^= data[i];
+		result *= 1099511628211ULL;
+	}
+	return result;
+}
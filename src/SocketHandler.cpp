@@ -7,20 +7,165 @@
 
 #include "pch.h"
 #include "SocketHandler.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "Serializer.h"
+#include "RateLimiter.h"
+#include "EndpointResolver.h"
+#include "CancellationToken.h"
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <mutex>
 #include <iostream>
+#if defined(__linux__)
+#include <netinet/tcp.h>  // TCP_CORK
+#endif
 
 using boost::asio::ip::tcp;
 using boost::asio::io_context;
 
-SocketHandler::SocketHandler() : _ioContext(nullptr), _resolver(nullptr), _socket(nullptr), _connected(false)
+constexpr size_t MIN_BANDWIDTH_SAMPLE = static_cast<size_t>(1) << 20;  // smaller sends mostly measure the socket buffer.
+
+SocketHandler::Tuning SocketHandler::_tuning;
+SocketHandler::Timeouts SocketHandler::_timeouts;
+std::atomic<uint64_t> SocketHandler::_rttNanos(0);
+std::atomic<uint64_t> SocketHandler::_bandwidth(0);
+
+/**
+ * Set socket options of following connections. Not to be called while sockets connect.
+ */
+void SocketHandler::setTuning(const Tuning& tuning)
 {
-	union   // Test for endianness
+	_tuning = tuning;
+}
+
+/**
+ * Set timeouts of following operations. Not to be called while sockets are in use.
+ */
+void SocketHandler::setTimeouts(const Timeouts& timeouts)
+{
+	_timeouts = timeouts;
+}
+
+/**
+ * The connection's socket, as seen by aborts on the io_context thread. Cleared before the socket is deleted,
+ * so an abort which comes late finds nothing to abort.
+ */
+struct SocketHandler::Connection
+{
+	std::mutex   mutex;
+	tcp::socket* socket = nullptr;
+};
+
+/**
+ * Aborts a blocking socket operation once its deadline passes. Cancellation of the transfer is watched per
+ * connection instead (see establish). The deadline is the earlier of timeout and the transfer's deadline.
+ * Nothing is armed without either of them. The timer runs on the shared io_context thread & is disarmed without
+ * waiting for it: an abort which fires meanwhile only shuts down a connection whose deadline has passed.
+ */
+class SocketHandler::Watchdog
+{
+public:
+	Watchdog(const SocketHandler& socket, const Metrics::ETimeout operation, const std::chrono::milliseconds timeout);
+	virtual ~Watchdog();
+	Watchdog(const Watchdog& other) = delete;
+	Watchdog& operator=(const Watchdog& other) = delete;
+
+private:
+	struct State
 	{
-		uint32_t i;
-		uint8_t c[sizeof(uint32_t)];
-	}tester{ 1 };
-	_bigEndian = (tester.c[0] == 0);
+		explicit State(io_context& context) : timer(context), armed(true) {}
+		boost::asio::steady_timer   timer;
+		std::shared_ptr<Connection> connection;
+		std::atomic<bool>           armed;     // cleared by whichever comes first, the timer or the destructor.
+	};
+
+	std::shared_ptr<State>             _state;     // shared with the pending timer handler.
+	std::shared_ptr<CancellationToken> _token;
+	Metrics::ETimeout                  _operation;
+	bool                               _transferDeadline;   // the transfer's deadline came first.
+	bool                               _cancelled;          // the transfer was cancelled before the operation.
+};
+
+SocketHandler::Watchdog::Watchdog(const SocketHandler& socket, const Metrics::ETimeout operation, const std::chrono::milliseconds timeout) :
+	_token(socket._cancellation), _operation(operation), _transferDeadline(false), _cancelled(_token && _token->isCancelled())
+{
+	auto deadline = std::chrono::steady_clock::time_point::max();
+	if (timeout.count() > 0)
+		deadline = std::chrono::steady_clock::now() + timeout;
+	if (_token && _token->deadline() < deadline)
+	{
+		deadline = _token->deadline();
+		_transferDeadline = true;
+	}
+	if (deadline == std::chrono::steady_clock::time_point::max() || !socket._connection)
+		return;
+
+	_state = std::make_shared<State>(EndpointResolver::instance().context());
+	_state->connection = socket._connection;
+	_state->timer.expires_at(deadline);
+	_state->timer.async_wait([state = _state](const boost::system::error_code& errorCode)
+		{
+			if (errorCode || !state->armed.exchange(false))
+				return;  // disarmed.
+			postAbort(state->connection);
+		});
+}
+
+/**
+ * Disarm and release the timer. Aborts are recorded as timeouts.
+ */
+SocketHandler::Watchdog::~Watchdog()
+{
+	auto& metrics = Metrics::instance();
+	if (_state)
+	{
+		const bool expired = !_state->armed.exchange(false);
+		boost::asio::post(_state->timer.get_executor(), [state = _state]() { state->timer.cancel(); });
+		if (expired)
+		{
+			metrics.recordTimeout(_transferDeadline ? Metrics::ETimeout::TIMEOUT_TRANSFER : _operation);
+			if (_transferDeadline)
+				_token->cancel();  // abort the transfer's operations on other sockets as well.
+			return;
+		}
+	}
+	if (_token && !_cancelled && _token->isCancelled())
+		metrics.recordTimeout(Metrics::ETimeout::TIMEOUT_CANCELLED);
+}
+
+/**
+ * Bandwidth-delay product of measured traffic, doubled & clamped to [MIN_SOCKET_BUFFER, MAX_SOCKET_BUFFER].
+ * 0 until both bandwidth and round trip were measured.
+ */
+size_t SocketHandler::bandwidthDelayProduct()
+{
+	const uint64_t rtt = _rttNanos.load(std::memory_order_relaxed);
+	const uint64_t bandwidth = _bandwidth.load(std::memory_order_relaxed);
+	if (rtt == 0 || bandwidth == 0)
+		return 0;
+	const double bdp = 2.0 * static_cast<double>(bandwidth) * static_cast<double>(rtt) / 1e9;
+	return std::clamp(static_cast<size_t>(bdp), MIN_SOCKET_BUFFER, MAX_SOCKET_BUFFER);
+}
+
+/**
+ * Exponential moving average (1/8 weight) of a lock-free estimate.
+ */
+void SocketHandler::updateEstimate(std::atomic<uint64_t>& estimate, const uint64_t sample)
+{
+	uint64_t current = estimate.load(std::memory_order_relaxed);
+	uint64_t updated;
+	do
+	{
+		updated = (current == 0) ? sample : (current - current / 8 + sample / 8);
+	} while (!estimate.compare_exchange_weak(current, updated, std::memory_order_relaxed));
+}
+
+SocketHandler::SocketHandler() : _socket(nullptr), _connected(false), _subscription(0)
+{
 }
 
 SocketHandler::~SocketHandler()
@@ -36,6 +181,7 @@ bool SocketHandler::setSocketInfo(const std::string& address, const std::string&
 	}
 	_address = address;
 	_port = port;
+	EndpointResolver::instance().prefetch(_address, _port);  // resolve in the background until first connect.
 
 	return true;
 }
@@ -76,21 +222,119 @@ bool SocketHandler::isValidPort(const std::string& port)
 }
 
 /**
- * Clear socket and connect to new socket.
+ * Use a speculatively established connection if there is one. Otherwise, clear socket and connect to new socket.
  */
 bool SocketHandler::connect()
 {
-	if (!isValidAddress(_address) || !isValidPort(_port))
+	return adoptPreconnected() || establish();
+}
+
+/**
+ * Start resolving & connecting in the background, e.g. while the request is being prepared.
+ * The following connect(), sendReceive() or sendOnly() uses the connection once it is ready.
+ */
+void SocketHandler::preconnect()
+{
+	if (_preconnect.valid())
+		return;  // already in progress.
+	_preconnect = std::async(std::launch::async, [this]() { return establish(); });
+}
+
+/**
+ * Wait for a pending speculative connect. Return true if it produced an open connection.
+ */
+bool SocketHandler::adoptPreconnected()
+{
+	if (!_preconnect.valid())
+		return false;
+	Metrics::PhaseScope phase(Metrics::EPhase::PHASE_CONNECT);
+	return _preconnect.get() && _connected;
+}
+
+/**
+ * Clear socket and connect to new socket.
+ */
+bool SocketHandler::establish()
+{
+	Tracer::Scope trace("SocketHandler::connect", "net");
+	if (!isValidAddress(_address) || !isValidPort(_port) || (_cancellation && _cancellation->isCancelled()))
 		return false;
 	try
 	{
-		close();  // close & clear current socket before new allocations.
-		_ioContext = new io_context;
-		_resolver = new tcp::resolver(*_ioContext);
-		_socket = new tcp::socket(*_ioContext);
-		boost::asio::connect(*_socket, _resolver->resolve(_address, _port, tcp::resolver::query::canonical_name));
+		closeSocket();  // close & clear current socket before new allocations.
+		auto& resolver = EndpointResolver::instance();
+		EndpointResolver::Endpoints endpoints;
+		if (!resolver.resolve(_address, _port, endpoints) || endpoints.empty())
+			return false;
+		_socket = new tcp::socket(resolver.context());  // shared io_context. Socket operations other than connect are synchronous.
+		_connection = std::make_shared<Connection>();
+		_connection->socket = _socket;
+		if (_cancellation)
+		{
+			// Watched once per connection rather than per operation: cancellation aborts whichever operation is blocked.
+			_subscribed = _cancellation;
+			_subscription = _subscribed->subscribe([connection = _connection]() { postAbort(connection); });
+		}
+		const auto start = std::chrono::steady_clock::now();
+#if defined(TCP_FASTOPEN_CONNECT)
+		if (_tuning.fastOpen)
+		{
+			// connect() returns at once. The SYN is sent along with the first write.
+			boost::system::error_code errorCode;
+			for (const auto& entry : endpoints)
+			{
+				_socket->close(errorCode);
+				_socket->open(entry.endpoint().protocol());
+				applyBuffers();
+				const int value = 1;
+				(void)setsockopt(_socket->native_handle(), IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &value, sizeof(value));
+				_socket->connect(entry.endpoint(), errorCode);
+				if (!errorCode)
+					break;
+			}
+			if (errorCode)
+				throw boost::system::system_error(errorCode);
+		}
+		else
+#endif
+		{
+			// Connect on the io_context thread, where the watchdog may abort it by closing the socket.
+			// Endpoints are tried in turn. Each attempt sizes the socket's buffers before its SYN, which fixes the window scale.
+			std::promise<boost::system::error_code> connected;
+			auto result = connected.get_future();
+			std::function<void(EndpointResolver::Endpoints::const_iterator)> attempt;
+			attempt = [this, &endpoints, &connected, &attempt](const EndpointResolver::Endpoints::const_iterator entry)
+			{
+				boost::system::error_code errorCode;
+				_socket->close(errorCode);
+				_socket->open(entry->endpoint().protocol(), errorCode);
+				if (!errorCode)
+					applyBuffers();
+				const auto next = [&endpoints, &connected, &attempt, entry](const boost::system::error_code& errorCode)
+				{
+					if (errorCode && errorCode != boost::asio::error::operation_aborted && std::next(entry) != endpoints.end())
+						attempt(std::next(entry));
+					else
+						connected.set_value(errorCode);
+				};
+				if (errorCode)
+					next(errorCode);
+				else
+					_socket->async_connect(entry->endpoint(), next);
+			};
+			boost::asio::post(resolver.context(), [&attempt, &endpoints]() { attempt(endpoints.begin()); });
+			boost::system::error_code errorCode;
+			{
+				Watchdog watchdog(*this, Metrics::ETimeout::TIMEOUT_CONNECT, _timeouts.connect);
+				errorCode = result.get();
+			}
+			if (errorCode)
+				throw boost::system::system_error(errorCode);
+			updateEstimate(_rttNanos, Metrics::elapsedNanos(start));
+		}
 		_socket->non_blocking(false);  // blocking socket..
 		_connected = true;
+		applyTuning();
 	}
 	catch (...)
 	{
@@ -100,151 +344,399 @@ bool SocketHandler::connect()
 }
 
 /**
- * Close & clear current socket.
+ * Apply _tuning's per connection options to the connected socket. Options the platform rejects are skipped.
+ */
+void SocketHandler::applyTuning() const
+{
+	boost::system::error_code errorCode;  // set_option() will not throw exception when error_code is passed as argument.
+	_socket->set_option(tcp::no_delay(_tuning.noDelay), errorCode);
+}
+
+/**
+ * Size the open socket's buffers by _tuning, before it connects: the window scale is fixed by the SYN.
+ * Buffers left at 0 keep the kernel's autotuning. Options the platform rejects are skipped.
+ */
+void SocketHandler::applyBuffers() const
+{
+	boost::system::error_code errorCode;  // set_option() will not throw exception when error_code is passed as argument.
+	size_t sendBuffer = _tuning.sendBuffer;
+	size_t receiveBuffer = _tuning.receiveBuffer;
+	if (_tuning.autoBuffers)
+	{
+		const size_t bdp = bandwidthDelayProduct();
+		sendBuffer = (sendBuffer != 0) ? sendBuffer : bdp;
+		receiveBuffer = (receiveBuffer != 0) ? receiveBuffer : bdp;
+	}
+	if (sendBuffer != 0)
+		_socket->set_option(boost::asio::socket_base::send_buffer_size(static_cast<int>(std::min(sendBuffer, MAX_SOCKET_BUFFER))), errorCode);
+	if (receiveBuffer != 0)
+		_socket->set_option(boost::asio::socket_base::receive_buffer_size(static_cast<int>(std::min(receiveBuffer, MAX_SOCKET_BUFFER))), errorCode);
+}
+
+/**
+ * Hold back partial segments until uncorked, so a request's packets leave in full segments.
+ */
+void SocketHandler::setCork(const bool cork) const
+{
+#if defined(TCP_CORK)
+	const int value = cork ? 1 : 0;
+	(void)setsockopt(_socket->native_handle(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#else
+	(void)cork;
+#endif
+}
+
+/**
+ * Abort the connection's pending connect and make blocking reads & writes of another thread return.
+ * Runs on the io_context thread. Nothing to do once the connection is closed.
+ */
+void SocketHandler::postAbort(const std::shared_ptr<Connection>& connection)
+{
+	boost::asio::post(EndpointResolver::instance().context(), [connection]()
+		{
+			std::lock_guard<std::mutex> lock(connection->mutex);
+			if (connection->socket == nullptr)
+				return;
+			boost::system::error_code errorCode;
+			connection->socket->cancel(errorCode);
+			connection->socket->shutdown(tcp::socket::shutdown_both, errorCode);
+		});
+}
+
+/**
+ * Close & clear current socket. A pending speculative connect is awaited & discarded.
  */
 void SocketHandler::close()
 {
+	if (_preconnect.valid())
+		(void)_preconnect.get();
+	closeSocket();
+}
+
+void SocketHandler::closeSocket()
+{
+	if (_subscribed)
+	{
+		_subscribed->unsubscribe(_subscription);
+		_subscribed.reset();
+	}
+	if (_connection)
+	{
+		std::lock_guard<std::mutex> lock(_connection->mutex);
+		_connection->socket = nullptr;
+	}
+	_connection.reset();
 	try
 	{
 		if (_socket != nullptr)
 			_socket->close();
 	}
 	catch (...) {} // Do Nothing
-	delete _ioContext;
-	delete _resolver;
 	delete _socket;
-	_ioContext = nullptr;
-	_resolver = nullptr;
 	_socket = nullptr;
 	_connected = false;
 }
 
 /**
- * Receive size bytes from _socket to buffer.
+ * Receive exactly size bytes from _socket straight into buffer.
  * Return false if unable to receive expected size bytes.
  */
 bool SocketHandler::receive(uint8_t* const buffer, const size_t size) const
 {
+	size_t received;
+	return receive(buffer, size, received);
+}
+
+/**
+ * As above. received counts the bytes which did arrive, also on failure.
+ */
+bool SocketHandler::receive(uint8_t* const buffer, const size_t size, size_t& received) const
+{
+	Tracer::Scope trace("SocketHandler::receive", "net");
+	received = 0;
 	if (_socket == nullptr || !_connected || buffer == nullptr || size == 0)
 	{
 		return false;
 	}
 
-	size_t bytesLeft = size;
-	uint8_t* ptr = buffer;
-	while (bytesLeft > 0)
-	{
-		uint8_t tempBuffer[PACKET_SIZE] = { 0 };
-		boost::system::error_code errorCode; // read() will not throw exception when error_code is passed as argument.
-		size_t bytesRead = read(*_socket, boost::asio::buffer(tempBuffer, PACKET_SIZE), errorCode);
-		if (bytesRead == 0)
-		{
-			return false;     // Error. Failed receiving and shouldn't use buffer.
-		}
+	boost::system::error_code errorCode; // read() will not throw exception when error_code is passed as argument.
+	Watchdog watchdog(*this, Metrics::ETimeout::TIMEOUT_RECEIVE, _timeouts.receive);
+	received = read(*_socket, boost::asio::buffer(buffer, size), errorCode);
+	return (received == size);
+}
 
-		if (_bigEndian)  // It's required to convert from little endian to big endian.
-		{
-			swapBytes(tempBuffer, bytesRead);
-		}
+/**
+ * Receive a framed response: ResponseHeader first, then exactly its payloadSize bytes straight after it.
+ * received is set to the response's total size, which may be shorter than resSize. On failure, it is 0 only if
+ * no byte of the response arrived.
+ * Return false if unable to receive or if the payload does not fit into resSize.
+ */
+bool SocketHandler::receiveResponse(uint8_t* const response, const size_t resSize, size_t& received) const
+{
+	received = 0;
+	if (resSize < sizeof(ResponseHeader) || !receive(response, sizeof(ResponseHeader), received))
+		return false;
 
-		const size_t bytesToCopy = (bytesLeft > bytesRead) ? bytesRead : bytesLeft;  // prevent buffer overflow.
-		memcpy(ptr, tempBuffer, bytesToCopy);
-		ptr += bytesToCopy;
-		bytesLeft = (bytesLeft < bytesToCopy) ? 0 : (bytesLeft - bytesToCopy);  // unsigned protection.
-	}
+	const csize_t payloadSize = Serializer::wire(reinterpret_cast<const ResponseHeader*>(response)->payloadSize);
+	if (payloadSize > resSize - sizeof(ResponseHeader))
+		return false;
+	if (payloadSize > 0 && !receive(response + sizeof(ResponseHeader), payloadSize))
+		return false;
+
+	received = sizeof(ResponseHeader) + payloadSize;
 	return true;
 }
 
 /**
- * Send size bytes from buffer to _socket.
+ * Send size bytes from buffer to _socket. buffer must already be in wire byte order (see Serializer).
  * Return false if unable to send expected size bytes.
  */
 bool SocketHandler::send(const uint8_t* const buffer, const size_t size) const
 {
-	if (_socket == nullptr || !_connected || buffer == nullptr || size == 0)
+	return send(buffer, size, nullptr, 0);
+}
+
+/**
+ * Send header followed by body as a single request, gathered straight from both. Both must be in wire byte order.
+ * The request is zero padded to whole PACKET_SIZE packets. body may be empty.
+ * While bandwidth is limited, the request is paced in RateLimiter::PACING_QUANTUM chunks.
+ * With a send timeout, each write of up to SEND_TIMEOUT_CHUNK bytes must complete within it.
+ * Return false if unable to send expected size bytes.
+ */
+bool SocketHandler::send(const uint8_t* const header, const size_t headerSize, const uint8_t* const body, const size_t bodySize) const
+{
+	static constexpr uint8_t PADDING[PACKET_SIZE] = { 0 };
+	Tracer::Scope trace("SocketHandler::send", "net");
+	if (_socket == nullptr || !_connected || header == nullptr || headerSize == 0 || (body == nullptr && bodySize != 0))
 		return false;
 
-	size_t bytesLeft = size;
-	const uint8_t* ptr = buffer;
-	while (bytesLeft > 0)
-	{
-		boost::system::error_code errorCode; // write() will not throw exception when error_code is passed as argument.
-		uint8_t tempBuffer[PACKET_SIZE] = { 0 };
-		const size_t bytesToSend = (bytesLeft > PACKET_SIZE) ? PACKET_SIZE : bytesLeft;
+	auto& limiter = RateLimiter::instance();
+	const bool paced = limiter.isEnabled();
+	const std::string server = paced ? (_address + ':' + _port) : std::string();
 
-		memcpy(tempBuffer, ptr, bytesToSend);
+	const size_t size = headerSize + bodySize;
+	const size_t padding = (PACKET_SIZE - size % PACKET_SIZE) % PACKET_SIZE;
+	const size_t total = size + padding;
+	size_t chunkSize = paced ? RateLimiter::PACING_QUANTUM : total;
+	if (_timeouts.send.count() > 0)
+		chunkSize = std::min(chunkSize, SEND_TIMEOUT_CHUNK);
+	const bool cork = _tuning.cork && (chunkSize < total);  // more than one write.
+	if (cork)
+		setCork(true);
 
-		if (_bigEndian)  // It's required to convert from big endian to little endian.
+	const std::array<std::pair<const uint8_t*, size_t>, 3> segments{ { { header, headerSize }, { body, bodySize }, { PADDING, padding } } };
+	const auto start = std::chrono::steady_clock::now();
+	const bool sent = [&]()
+	{
+		boost::system::error_code errorCode; // write() will not throw exception when error_code is passed as argument.
+		for (size_t offset = 0; offset < total; offset += chunkSize)
 		{
-			swapBytes(tempBuffer, bytesToSend);
+			const size_t chunk = std::min(chunkSize, total - offset);
+			std::array<boost::asio::const_buffer, 3> buffers;
+			size_t position = 0;
+			for (size_t i = 0; i < segments.size(); ++i)
+			{
+				const auto [data, bytes] = segments[i];
+				const size_t first = std::clamp(offset, position, position + bytes);
+				const size_t last = std::clamp(offset + chunk, position, position + bytes);
+				buffers[i] = boost::asio::buffer(data + (first - position), last - first);
+				position += bytes;
+			}
+			if (paced)
+				limiter.acquire(server, chunk);
+			Watchdog watchdog(*this, Metrics::ETimeout::TIMEOUT_SEND, _timeouts.send);
+			if (write(*_socket, buffers, errorCode) != chunk)
+				return false;
 		}
+		return true;
+	}();
 
-		const size_t bytesWritten = write(*_socket, boost::asio::buffer(tempBuffer, PACKET_SIZE), errorCode);
-		if (bytesWritten == 0)
-			return false;
-
-		ptr += bytesWritten;
-		bytesLeft = (bytesLeft < bytesWritten) ? 0 : (bytesLeft - bytesWritten);  // unsigned protection.
+	if (cork)
+		setCork(false);  // flush.
+	if (sent && !paced && size >= MIN_BANDWIDTH_SAMPLE)
+	{
+		const uint64_t nanos = Metrics::elapsedNanos(start);
+		if (nanos > 0)
+			updateEstimate(_bandwidth, static_cast<uint64_t>(static_cast<double>(size) * 1e9 / static_cast<double>(nanos)));
 	}
+	return sent;
+}
+
+/**
+ * Send header followed by body in a single gathered write, without packet padding. body may be empty.
+ * Used by framed protocols which define their own message boundaries.
+ */
+bool SocketHandler::sendUnpadded(const uint8_t* const header, const size_t headerSize, const uint8_t* const body, const size_t bodySize) const
+{
+	Tracer::Scope trace("SocketHandler::sendUnpadded", "net");
+	if (_socket == nullptr || !_connected || header == nullptr || headerSize == 0 || (body == nullptr && bodySize != 0))
+		return false;
+
+	auto& limiter = RateLimiter::instance();
+	if (limiter.isEnabled())
+		limiter.acquire(_address + ':' + _port, headerSize + bodySize);  // frames are small enough to be paced whole.
+
+	const std::array<boost::asio::const_buffer, 2> buffers{ boost::asio::buffer(header, headerSize), boost::asio::buffer(body, bodySize) };
+	boost::system::error_code errorCode; // write() will not throw exception when error_code is passed as argument.
+	Watchdog watchdog(*this, Metrics::ETimeout::TIMEOUT_SEND, _timeouts.send);
+	return (write(*_socket, buffers, errorCode) == headerSize + bodySize);
+}
+
+/**
+ * Let writer send bytes on the native socket outside of asio, e.g. batched through io_uring.
+ * bytes are paced whole, and writer runs under the send timeout & cancellation like any other send.
+ */
+bool SocketHandler::sendWith(const std::function<bool(const tcp::socket::native_handle_type)>& writer, const size_t bytes) const
+{
+	Tracer::Scope trace("SocketHandler::sendWith", "net");
+	if (_socket == nullptr || !_connected || !writer)
+		return false;
+
+	auto& limiter = RateLimiter::instance();
+	if (limiter.isEnabled())
+		limiter.acquire(_address + ':' + _port, bytes);
+
+	Watchdog watchdog(*this, Metrics::ETimeout::TIMEOUT_SEND, _timeouts.send);
+	return writer(_socket->native_handle());
+}
+
+/**
+ * Return false if the peer closed or reset the connection, e.g. an idle or speculative connection the server dropped.
+ * Pending input is not consumed.
+ */
+bool SocketHandler::isAlive() const
+{
+	if (_socket == nullptr || !_connected)
+		return false;
+#if defined(MSG_DONTWAIT)
+	uint8_t byte;
+	const auto result = ::recv(_socket->native_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	return (result > 0) || (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+#else
 	return true;
+#endif
+}
+
+/**
+ * Return true if received bytes are waiting to be read, so a following receive will not block for long.
+ */
+bool SocketHandler::hasPendingInput() const
+{
+	if (_socket == nullptr || !_connected)
+		return false;
+	boost::system::error_code errorCode;
+	return (_socket->available(errorCode) > 0) && !errorCode;
 }
 
 /**
- * Wrap connect, send, receive and close functions.
+ * Wrap connect, send, receive and close functions. An open connection, or one started by preconnect(), is used if there is one.
+ * The response is framed by its header, so it may be shorter than resSize (e.g. a failure response without payload).
  * Inner function have validations. Hence, this function does not validate arguments.
  */
 bool SocketHandler::sendReceive(const uint8_t* const toSend, const size_t size, uint8_t* const response, const size_t resSize)
 {
-	if (!connect())
+	return sendReceive(toSend, size, nullptr, 0, response, resSize);
+}
+
+/**
+ * As sendReceive, for a request whose header & body are sent gathered from separate buffers.
+ */
+bool SocketHandler::sendReceive(const uint8_t* const header, const size_t headerSize, const uint8_t* const body, const size_t bodySize,
+	uint8_t* const response, const size_t resSize)
+{
+	auto& metrics = Metrics::instance();
+	const size_t size = headerSize + bodySize;
+	const code_t code = requestCode(header, headerSize);
+	const auto start = std::chrono::steady_clock::now();
+	// Already connected by the caller or speculatively. A connection the server closed meanwhile is replaced.
+	bool reused = (_connected || adoptPreconnected()) && isAlive();
+	if (!reused)
 	{
-		return false;
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_CONNECT);
+		if (!establish())
+		{
+			return false;
+		}
 	}
-	if (!send(toSend, size))
+	metrics.recordLatency(code, Metrics::ELatency::LATENCY_CONNECT, Metrics::elapsedNanos(start));
+	auto stageStart = std::chrono::steady_clock::now();
 	{
-		close();
-		return false;
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, size);
+		// A reused connection may have been dropped by the server meanwhile. Retry once on a new one.
+		if (!send(header, headerSize, body, bodySize))
+		{
+			if (!reused || !establish() || !send(header, headerSize, body, bodySize))
+			{
+				close();
+				return false;
+			}
+			reused = false;
+		}
 	}
-	if (!receive(response, resSize))
+	metrics.recordLatency(code, Metrics::ELatency::LATENCY_SEND, Metrics::elapsedNanos(stageStart));
+	stageStart = std::chrono::steady_clock::now();
 	{
-		close();
-		return false;
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_RESPONSE_WAIT);
+		size_t received = 0;
+		// A reused connection may also be dropped once the request was written into it. If no response byte arrived,
+		// an idempotent request is sent once more on a new connection.
+		if (!receiveResponse(response, resSize, received) &&
+			!(reused && received == 0 && isIdempotent(code) && establish() && send(header, headerSize, body, bodySize) &&
+				receiveResponse(response, resSize, received)))
+		{
+			close();
+			return false;
+		}
+		phase.addBytes(received);
 	}
+	metrics.recordLatency(code, Metrics::ELatency::LATENCY_RESPONSE_WAIT, Metrics::elapsedNanos(stageStart));
+	metrics.recordLatency(code, Metrics::ELatency::LATENCY_ROUND_TRIP, Metrics::elapsedNanos(start));
 	close();
 	return true;
 }
 
 /**
- * Wrap connect, send and close functions.
+ * Wrap connect, send and close functions. An open connection, or one started by preconnect(), is used if there is one.
  * Inner function have validations. Hence, this function does not validate arguments.
  */
 bool SocketHandler::sendOnly(const uint8_t* const toSend, const size_t size)
 {
-	if (!connect())
+	auto& metrics = Metrics::instance();
+	const code_t code = requestCode(toSend, size);
+	const auto start = std::chrono::steady_clock::now();
+	// Already connected by the caller or speculatively. A connection the server closed meanwhile is replaced.
+	const bool reused = (_connected || adoptPreconnected()) && isAlive();
+	if (!reused)
 	{
-		return false;
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_CONNECT);
+		if (!establish())
+		{
+			return false;
+		}
 	}
-	if (!send(toSend, size))
+	metrics.recordLatency(code, Metrics::ELatency::LATENCY_CONNECT, Metrics::elapsedNanos(start));
+	const auto sendStart = std::chrono::steady_clock::now();
 	{
-		close();
-		return false;
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, size);
+		// A reused connection may have been dropped by the server meanwhile. Retry once on a new one.
+		if (!send(toSend, size) && !(reused && establish() && send(toSend, size)))
+		{
+			close();
+			return false;
+		}
 	}
+	metrics.recordLatency(code, Metrics::ELatency::LATENCY_SEND, Metrics::elapsedNanos(sendStart));
+	metrics.recordLatency(code, Metrics::ELatency::LATENCY_ROUND_TRIP, Metrics::elapsedNanos(start));
 	close();
 	return true;
 }
 
 /**
- * Handle Endianness.
+ * Peek the request code of an outgoing message. Every request starts with a RequestHeader.
  */
-void SocketHandler::swapBytes(uint8_t* const buffer, size_t size) const
+code_t SocketHandler::requestCode(const uint8_t* const buffer, const size_t size)
 {
-	if (buffer == nullptr || size < sizeof(uint32_t))
-		return;
-
-	size -= (size % sizeof(uint32_t));
-	uint32_t* const ptr = reinterpret_cast<uint32_t* const>(buffer);
-	for (size_t i = 0; i < size; ++i)
-	{
-		const uint32_t tmp = ((buffer[i] << 8) & 0xFF00FF00) | ((buffer[i] >> 8) & 0xFF00FF);
-		buffer[i] = (tmp << 16) | (tmp >> 16);
-	}
+	if (buffer == nullptr || size < sizeof(RequestHeader))
+		return DEFAULT_VALUE;
+	return Serializer::wire(reinterpret_cast<const RequestHeader*>(buffer)->code);  // buffer is in wire byte order.
 }
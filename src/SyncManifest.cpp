@@ -0,0 +1,75 @@
+/**
+ * Encrypted File Transfer Client
+ * @file SyncManifest.cpp
+ * @brief Size & last write time of each file uploaded by directory sync.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "SyncManifest.h"
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+
+/**
+ * Load the manifest stored at path, which save() writes back to. A missing file is an empty manifest.
+ * Return false if the file has an invalid line.
+ */
+bool SyncManifest::load(const std::string& path)
+{
+	_path = path;
+	_files.clear();
+	std::ifstream in(path);
+	if (!in.is_open())
+		return true;  // nothing synced yet.
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.empty())
+			continue;
+		std::istringstream fields(line);
+		State state;
+		std::string file;
+		if (!(fields >> state.size) || fields.get() != '\t' || !(fields >> state.modified) || fields.get() != '\t' ||
+			!std::getline(fields, file) || file.empty())
+			return false;
+		_files[file] = state;
+	}
+	return true;
+}
+
+/**
+ * Write to a temporary file and rename it, so an interrupted save keeps the previous manifest.
+ */
+bool SyncManifest::save() const
+{
+	if (_path.empty())
+		return false;
+	const std::string tempPath = _path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::out | std::ios::trunc);
+		if (!out.is_open())
+			return false;
+		for (const auto& [file, state] : _files)
+			out << state.size << '\t' << state.modified << '\t' << file << '\n';
+		if (!out.good())
+			return false;
+	}
+	boost::system::error_code errorCode;  // rename() will not throw exception when error_code is passed as argument.
+	boost::filesystem::rename(tempPath, _path, errorCode);
+	return !errorCode;
+}
+
+/**
+ * Return true unless path was synced with the same size & last write time.
+ */
+bool SyncManifest::isChanged(const std::string& path, const uint64_t size, const int64_t modified) const
+{
+	const auto it = _files.find(path);
+	return (it == _files.end()) || (it->second.size != size) || (it->second.modified != modified);
+}
+
+void SyncManifest::update(const std::string& path, const uint64_t size, const int64_t modified)
+{
+	_files[path] = { size, modified };
+}
@@ -0,0 +1,121 @@
+/**
+ * Encrypted File Transfer Client
+ * @file Tracer.cpp
+ * @brief Low overhead event tracing of the client pipeline, exported in Chrome trace JSON format.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "Tracer.h"
+#include <fstream>
+#include <iomanip>
+
+thread_local Tracer::ThreadBuffer* Tracer::_threadBuffer = nullptr;
+
+Tracer::Scope::Scope(const char* name, const char* category) : _name(name), _category(category), _active(Tracer::instance().isEnabled())
+{
+	if (_active)
+		Tracer::instance().add(_name, _category, 'B');
+}
+
+Tracer::Scope::~Scope()
+{
+	if (_active)
+		Tracer::instance().add(_name, _category, 'E');
+}
+
+Tracer& Tracer::instance()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+Tracer::Tracer() : _enabled(false), _epoch(std::chrono::steady_clock::now())
+{
+}
+
+/**
+ * Export trace on exit.
+ */
+Tracer::~Tracer()
+{
+	if (_outputPath.empty())
+		return;
+	try
+	{
+		(void)exportChromeTrace(_outputPath);
+	}
+	catch (...) {} // Do Nothing
+}
+
+/**
+ * Export trace to path upon exit. Empty path disables output.
+ */
+void Tracer::setOutput(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_outputPath = path;
+}
+
+/**
+ * Lazily allocate & register the calling thread's ring buffer.
+ * Buffers are owned by Tracer so events outlive their threads.
+ */
+Tracer::ThreadBuffer* Tracer::threadBuffer()
+{
+	if (_threadBuffer == nullptr)
+	{
+		auto buffer = std::make_unique<ThreadBuffer>();
+		std::lock_guard<std::mutex> lock(_mutex);
+		buffer->tid = static_cast<uint32_t>(_buffers.size() + 1);
+		_threadBuffer = buffer.get();
+		_buffers.push_back(std::move(buffer));
+	}
+	return _threadBuffer;
+}
+
+void Tracer::add(const char* name, const char* category, const char phase)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+	auto& event = buffer->events[head % RING_EVENTS];
+	event.name = name;
+	event.category = category;
+	event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _epoch).count();
+	event.phase = phase;
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * Write all buffered events in Chrome trace JSON format.
+ * Events written concurrently with the export may be missing.
+ */
+bool Tracer::exportChromeTrace(const std::string& path) const
+{
+	std::ofstream out(path, std::ios::out | std::ios::trunc);
+	if (!out.is_open())
+		return false;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	out << std::fixed << std::setprecision(3);  // ts is in microseconds.
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first = true;
+	for (const auto& buffer : _buffers)
+	{
+		out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+			<< ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+		first = false;
+
+		const uint64_t head = buffer->head.load(std::memory_order_acquire);
+		const uint64_t begin = (head > RING_EVENTS) ? (head - RING_EVENTS) : 0;
+		for (uint64_t i = begin; i < head; ++i)
+		{
+			const auto& event = buffer->events[i % RING_EVENTS];
+			out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"" << event.phase
+				<< "\",\"ts\":" << event.timestamp / 1e3
+				<< ",\"pid\":1,\"tid\":" << buffer->tid << '}';
+		}
+	}
+	out << "\n]}\n";
+	return out.good();
+}
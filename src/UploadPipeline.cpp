@@ -0,0 +1,418 @@
+/**
+ * Encrypted File Transfer Client
+ * @file UploadPipeline.cpp
+ * @brief Staged upload of a file: reader -> CRC & encryption -> sender, each stage on its own thread.
+ * @author Arthur Rennert
+ */
+
+#include "pch.h"
+#include "UploadPipeline.h"
+#include "AESWrapper.h"
+#include "BufferPool.h"
+#include "FileHandler.h"
+#include "IoUring.h"
+#include "Metrics.h"
+#include "SocketHandler.h"
+#include "SpscRing.h"
+#include "Tracer.h"
+#include <boost/crc.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+/**
+ * State shared by the stages of a single upload.
+ */
+struct UploadPipeline::Stages
+{
+	struct Chunk
+	{
+		size_t slot = 0;   // index into buffers.
+		size_t size = 0;
+	};
+
+	Stages(std::vector<BufferPool::Buffer>& plain, std::vector<BufferPool::Buffer>& cipher, const size_t queueDepth) :
+		plainBuffers(plain), cipherBuffers(cipher), plainRing(queueDepth), cipherRing(queueDepth),
+		freePlain(plain.size()), freeCipher(cipher.size()) {}
+
+	// Phases of the reader & crypto stages, added to the caller's transfer once they are joined.
+	void record(const Metrics::EPhase phase, const std::chrono::steady_clock::time_point& start, const size_t bytes)
+	{
+		phaseNanos[static_cast<size_t>(phase)] += Metrics::elapsedNanos(start);
+		phaseBytes[static_cast<size_t>(phase)] += bytes;
+	}
+
+	std::string                     filePath;
+	size_t                          fileSize = 0;
+	size_t                          contentSize = 0;   // cipher text bytes.
+	const uint8_t*                  header = nullptr;
+	size_t                          headerSize = 0;
+	size_t                          sent = 0;          // cipher text bytes sent.
+	std::vector<BufferPool::Buffer>& plainBuffers;     // the pipeline's.
+	std::vector<BufferPool::Buffer>& cipherBuffers;
+	SpscRing<Chunk>                 plainRing;         // reader -> crypto.
+	SpscRing<Chunk>                 cipherRing;        // crypto -> sender.
+	SpscRing<size_t>                freePlain;         // crypto -> reader.
+	SpscRing<size_t>                freeCipher;        // sender -> crypto.
+	std::array<uint64_t, Metrics::PHASES> phaseNanos{};   // each written by a single stage.
+	std::array<uint64_t, Metrics::PHASES> phaseBytes{};
+};
+
+UploadPipeline::UploadPipeline(const size_t chunkSize, const size_t queueDepth, const bool ioUring) :
+	_chunkSize(std::max(chunkSize, MIN_CHUNK_SIZE) / FileHandler::DIRECT_ALIGNMENT * FileHandler::DIRECT_ALIGNMENT),
+	_queueDepth(std::max<size_t>(queueDepth, 1)), _readRegistered(false), _sendRegistered(false)
+{
+	const size_t slotCount = _queueDepth + 2;   // the ring's chunks, plus the one each side works on.
+	for (size_t slot = 0; slot < slotCount; ++slot)
+	{
+		_plainBuffers.push_back(BufferPool::instance().acquire(_chunkSize));
+		_cipherBuffers.push_back(BufferPool::instance().acquire(_chunkSize + AESWrapper::BLOCK_SIZE));  // + padding.
+	}
+	if (ioUring && IoUring::isSupported())
+	{
+		_readRing = std::make_unique<IoUring>(static_cast<unsigned>(slotCount));
+		_sendRing = std::make_unique<IoUring>(static_cast<unsigned>(slotCount + 2));   // + header & padding.
+	}
+}
+
+UploadPipeline::~UploadPipeline() = default;
+
+/**
+ * Send header followed by the encrypted file, zero padded to PACKET_SIZE as SocketHandler::send does.
+ * header must be in wire byte order and announce AESWrapper::cipherSize(fileSize) content bytes.
+ * The sender stage runs on the calling thread; reader & crypto stages on threads of their own.
+ * crc is the CRC of the plain text, valid if RESULT_OK is returned. The response is left to the caller.
+ * RESULT_START_FAILED if a stage's thread could not be started; nothing was sent then.
+ */
+UploadPipeline::EResult UploadPipeline::send(SocketHandler& socket, const std::string& filePath, const size_t fileSize, const AESKey& key,
+	const uint8_t* const header, const size_t headerSize, uint32_t& crc)
+{
+	Tracer::Scope trace("UploadPipeline::send", "client");
+	Stages stages(_plainBuffers, _cipherBuffers, _queueDepth);
+	stages.filePath = filePath;
+	stages.fileSize = fileSize;
+	stages.contentSize = AESWrapper::cipherSize(fileSize);
+	stages.header = header;
+	stages.headerSize = headerSize;
+	for (size_t slot = 0; slot < _plainBuffers.size(); ++slot)
+	{
+		(void)stages.freePlain.push(size_t(slot));
+		(void)stages.freeCipher.push(size_t(slot));
+	}
+
+	// Buffers are registered upon the first upload only. Unregistered buffers still work, at a copy's cost.
+	const bool readRing = _readRing && _readRing->isReady();
+	const bool sendRing = _sendRing && _sendRing->isReady();
+	if (readRing && !_readRegistered)
+	{
+		std::vector<std::span<uint8_t>> buffers;
+		for (const auto& buffer : _plainBuffers)
+			buffers.emplace_back(buffer.data(), _chunkSize);
+		_readRegistered = _readRing->registerBuffers(buffers);
+	}
+	if (sendRing && !_sendRegistered)
+	{
+		std::vector<std::span<uint8_t>> buffers;
+		for (const auto& buffer : _cipherBuffers)
+			buffers.emplace_back(buffer.data(), buffer.size());
+		_sendRegistered = _sendRing->registerBuffers(buffers);
+	}
+
+	std::jthread reader;     // joined when leaving, also if the encryptor failed to start.
+	std::jthread encryptor;
+	try
+	{
+		reader = std::jthread([&]()
+		{
+			if (readRing)
+				readUring(stages, *_readRing);
+			else
+				read(stages);
+			stages.plainRing.close();
+		});
+		encryptor = std::jthread([&]()
+		{
+			encrypt(stages, key, crc);
+			stages.plainRing.close();   // stop the reader if sending failed.
+			stages.freePlain.close();
+			stages.cipherRing.close();
+		});
+	}
+	catch (const std::system_error&)
+	{
+		stages.plainRing.close();   // stop the reader, which would wait for the encryptor's free buffers.
+		stages.freePlain.close();
+		return EResult::RESULT_START_FAILED;
+	}
+
+	const bool success = sendRing ? sendUring(stages, socket, *_sendRing) : sendSocket(stages, socket);
+	stages.cipherRing.close();  // stop the encryptor if sending failed.
+	stages.freeCipher.close();
+	reader.join();
+	encryptor.join();
+	for (size_t phase = 0; phase < Metrics::PHASES; ++phase)
+	{
+		if (stages.phaseNanos[phase] > 0)
+			Metrics::addPhase(static_cast<Metrics::EPhase>(phase), stages.phaseNanos[phase], stages.phaseBytes[phase]);
+	}
+
+	if (!success)
+		return EResult::RESULT_SEND_FAILED;
+	return (stages.sent == stages.contentSize) ? EResult::RESULT_OK : EResult::RESULT_READ_FAILED;
+}
+
+/**
+ * Reader stage: read the file in chunks through FileHandler.
+ */
+void UploadPipeline::read(Stages& stages) const
+{
+	Tracer::Scope trace("UploadPipeline::read", "io");
+	FileHandler file;
+	if (!file.openSequential(stages.filePath))
+		return;
+	size_t slot;
+	for (size_t offset = 0; offset < stages.fileSize && stages.freePlain.pop(slot); offset += _chunkSize)
+	{
+		const Stages::Chunk chunk{ slot, std::min(_chunkSize, stages.fileSize - offset) };
+		const auto start = std::chrono::steady_clock::now();
+		const bool success = file.read(stages.plainBuffers[slot].data(), chunk.size);
+		stages.record(Metrics::EPhase::PHASE_READ, start, success ? chunk.size : 0);
+		if (!success || !stages.plainRing.push(Stages::Chunk(chunk)))
+			return;
+	}
+}
+
+/**
+ * Reader stage: read as many chunks as there are free buffers in a single io_uring submission, into registered buffers.
+ */
+void UploadPipeline::readUring(Stages& stages, IoUring& ring) const
+{
+	Tracer::Scope trace("UploadPipeline::readUring", "io");
+	FileHandler file;
+	if (!file.openSequential(stages.filePath) || file.descriptor() < 0)
+		return;
+	const bool registered = _readRegistered;
+
+	struct Read
+	{
+		Stages::Chunk chunk;
+		size_t        offset = 0;   // in file.
+		size_t        done = 0;
+	};
+	std::vector<Read> batch;
+	std::vector<IoUring::Completion> completions;
+	size_t slot;
+	for (size_t offset = 0; offset < stages.fileSize && stages.freePlain.pop(slot);)
+	{
+		// Wait for one free buffer, then take whichever others are free already.
+		batch.clear();
+		do
+		{
+			batch.push_back({ { slot, std::min(_chunkSize, stages.fileSize - offset) }, offset, 0 });
+			offset += batch.back().chunk.size;
+		} while (offset < stages.fileSize && batch.size() < ring.entries() && stages.freePlain.tryPop(slot));
+
+		// Submit all at once. Short reads are resubmitted for the rest.
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t pending = batch.size(); pending > 0;)
+		{
+			size_t prepared = 0;
+			for (size_t i = 0; i < batch.size(); ++i)
+			{
+				Read& read = batch[i];
+				if (read.done == read.chunk.size)
+					continue;
+				// Direct reads must be aligned. The last chunk's is rounded up & ends short at the end of file.
+				uint8_t* const dest = stages.plainBuffers[read.chunk.slot].data() + read.done;
+				size_t length = read.chunk.size - read.done;
+				if (file.isDirect())
+					length = (length + FileHandler::DIRECT_ALIGNMENT - 1) / FileHandler::DIRECT_ALIGNMENT * FileHandler::DIRECT_ALIGNMENT;
+				if (!ring.prepareRead(file.descriptor(), registered ? static_cast<int>(read.chunk.slot) : IoUring::UNREGISTERED,
+					dest, length, read.offset + read.done, i))
+					return;
+				prepared++;
+			}
+			if (!ring.submitAndWait(prepared, completions))
+				return;
+			for (const auto& completion : completions)
+			{
+				if (completion.result <= 0)
+					return;  // error, or end of file before fileSize.
+				Read& read = batch[completion.userData];
+				read.done = std::min(read.done + static_cast<size_t>(completion.result), read.chunk.size);
+				if (read.done == read.chunk.size)
+					pending--;
+				else if (file.isDirect() && read.done % FileHandler::DIRECT_ALIGNMENT != 0)
+					file.disableDirect();  // the rest would start unaligned, which O_DIRECT rejects.
+			}
+		}
+		stages.record(Metrics::EPhase::PHASE_READ, start, offset - batch.front().offset);
+		Metrics::instance().recordFileRead(offset - batch.front().offset, file.isDirect());
+		file.dropBehind(offset);
+		for (const Read& read : batch)
+		{
+			if (!stages.plainRing.push(Stages::Chunk(read.chunk)))
+				return;
+		}
+	}
+}
+
+/**
+ * Crypto stage: CRC & encrypt chunks in order. The last one is padded.
+ */
+void UploadPipeline::encrypt(Stages& stages, const AESKey& key, uint32_t& crc) const
+{
+	Tracer::Scope trace("UploadPipeline::encrypt", "crypto");
+	auto& metrics = Metrics::instance();
+	boost::crc_32_type checksum;
+	AESWrapper::Encryptor aes(key);
+	size_t processed = 0;
+	Stages::Chunk plain;
+	size_t slot;
+	for (;;)
+	{
+		metrics.recordQueueOccupancy(Metrics::EQueue::QUEUE_READ, stages.plainRing.size(), stages.plainRing.capacity());
+		if (!stages.plainRing.pop(plain) || !stages.freeCipher.pop(slot))
+			break;
+		const uint8_t* const data = stages.plainBuffers[plain.slot].data();
+		auto start = std::chrono::steady_clock::now();
+		checksum.process_bytes(data, plain.size);
+		stages.record(Metrics::EPhase::PHASE_CRC, start, plain.size);
+		processed += plain.size;
+		const std::span<const uint8_t> in(data, plain.size);
+		const std::span<uint8_t> out(stages.cipherBuffers[slot].data(), stages.cipherBuffers[slot].size());
+		start = std::chrono::steady_clock::now();
+		const size_t size = (processed == stages.fileSize) ? aes.finish(in, out) : aes.update(in, out);
+		stages.record(Metrics::EPhase::PHASE_ENCRYPT, start, plain.size);
+		if (size == 0 || !stages.freePlain.push(size_t(plain.slot)) || !stages.cipherRing.push({ slot, size }))
+			break;
+	}
+	crc = checksum.checksum();
+}
+
+/**
+ * Sender stage: send chunks through SocketHandler, the first one along with the header.
+ */
+bool UploadPipeline::sendSocket(Stages& stages, SocketHandler& socket) const
+{
+	auto& metrics = Metrics::instance();
+	Stages::Chunk chunk;
+	for (;;)
+	{
+		metrics.recordQueueOccupancy(Metrics::EQueue::QUEUE_CRYPTO, stages.cipherRing.size(), stages.cipherRing.capacity());
+		if (!stages.cipherRing.pop(chunk))
+			break;
+		const uint8_t* const data = stages.cipherBuffers[chunk.slot].data();
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, chunk.size);
+		const bool success = (stages.sent == 0) ? socket.sendUnpadded(stages.header, stages.headerSize, data, chunk.size) :
+			socket.sendUnpadded(data, chunk.size, nullptr, 0);
+		if (!success || !stages.freeCipher.push(size_t(chunk.slot)))
+			return false;
+		stages.sent += chunk.size;
+	}
+
+	const size_t padding = (PACKET_SIZE - (stages.headerSize + stages.sent) % PACKET_SIZE) % PACKET_SIZE;
+	if (stages.sent == stages.contentSize && padding > 0)
+	{
+		const uint8_t zeros[PACKET_SIZE] = { 0 };
+		return socket.sendUnpadded(zeros, padding, nullptr, 0);
+	}
+	return true;
+}
+
+/**
+ * Sender stage: send whichever chunks are encrypted already as a chain of linked io_uring writes,
+ * from registered buffers, in a single submission. Writes after a short one are resubmitted for the rest.
+ */
+bool UploadPipeline::sendUring(Stages& stages, SocketHandler& socket, IoUring& ring) const
+{
+	Tracer::Scope trace("UploadPipeline::sendUring", "net");
+	auto& metrics = Metrics::instance();
+	const bool registered = _sendRegistered;
+
+	struct Write
+	{
+		const uint8_t* data = nullptr;
+		size_t         size = 0;
+		size_t         done = 0;
+		int            buffer = IoUring::UNREGISTERED;
+		size_t         slot = SIZE_MAX;    // SIZE_MAX for header & padding.
+	};
+	const uint8_t zeros[PACKET_SIZE] = { 0 };
+	std::vector<Write> batch;
+	std::vector<IoUring::Completion> completions;
+	Stages::Chunk chunk;
+	size_t queued = 0;   // cipher text bytes queued so far.
+	for (;;)
+	{
+		metrics.recordQueueOccupancy(Metrics::EQueue::QUEUE_CRYPTO, stages.cipherRing.size(), stages.cipherRing.capacity());
+		if (!stages.cipherRing.pop(chunk))
+			break;
+		batch.clear();
+		if (queued == 0)
+			batch.push_back({ stages.header, stages.headerSize });
+		do
+		{
+			batch.push_back({ stages.cipherBuffers[chunk.slot].data(), chunk.size, 0,
+				registered ? static_cast<int>(chunk.slot) : IoUring::UNREGISTERED, chunk.slot });
+			queued += chunk.size;
+		} while (batch.size() + 1 < ring.entries() && stages.cipherRing.tryPop(chunk));
+		const size_t padding = (PACKET_SIZE - (stages.headerSize + queued) % PACKET_SIZE) % PACKET_SIZE;
+		if (queued == stages.contentSize && padding > 0)
+			batch.push_back({ zeros, padding });
+
+		size_t bytes = 0;
+		for (const Write& write : batch)
+			bytes += write.size;
+		Metrics::PhaseScope phase(Metrics::EPhase::PHASE_SEND, bytes);
+		const bool success = socket.sendWith([&](const tcp::socket::native_handle_type handle)
+		{
+			const int fd = static_cast<int>(handle);
+			for (size_t next = 0; next < batch.size();)
+			{
+				size_t prepared = 0;
+				for (size_t i = next; i < batch.size(); ++i)
+				{
+					const Write& write = batch[i];
+					if (!ring.prepareWrite(fd, write.buffer, write.data + write.done, write.size - write.done, i + 1 < batch.size(), i))
+						return false;
+					prepared++;
+				}
+				if (!ring.submitAndWait(prepared, completions))
+					return false;
+				for (const auto& completion : completions)
+				{
+					if (completion.isCancelled())
+						continue;  // resubmitted below.
+					if (completion.result <= 0)
+						return false;
+					batch[completion.userData].done += static_cast<size_t>(completion.result);
+				}
+				while (next < batch.size() && batch[next].done == batch[next].size)
+					next++;
+				// Links keep writes in order. Bytes written past an incomplete write would corrupt the stream.
+				for (size_t i = next + 1; i < batch.size(); ++i)
+				{
+					if (batch[i].done > 0)
+						return false;
+				}
+			}
+			return true;
+		}, bytes);
+		if (!success)
+			return false;
+
+		for (const Write& write : batch)
+		{
+			if (write.slot == SIZE_MAX)
+				continue;
+			stages.sent += write.size;
+			if (!stages.freeCipher.push(size_t(write.slot)))
+				return false;
+		}
+	}
+	return true;
+}